@@ -0,0 +1,281 @@
+/*
+ *  This file is part of vaporpp.
+ *
+ *  vaporpp is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vaporpp is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vaporpp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <boost/program_options.hpp>
+
+#include "../bus/device.hpp"
+#include "../bus/encoder.hpp"
+#include "../bus/framer.hpp"
+#include "../bus/protocol.hpp"
+
+using vlpp::bus::bus_clock;
+
+namespace {
+
+typedef std::vector<uint8_t> payload;
+
+/*
+ * Splits the received bytes into frames and unescapes them
+ * like isr_read_command in led-boards/usart2.c.
+ */
+class receiver {
+	public:
+		void feed(const uint8_t* data, size_t length) {
+			using namespace vlpp::bus;
+			for (size_t i = 0; i < length; ++i) {
+				uint8_t byte = data[i];
+				if (byte == START_MARK) {
+					finish();
+					_in_frame = true;
+					_escape = false;
+					continue;
+				}
+				if (!_in_frame) {
+					continue;
+				}
+				if (_escape) {
+					_escape = false;
+					if (byte > 0x01) {
+						++bad_escapes;
+						_in_frame = false;
+						_current.clear();
+						continue;
+					}
+					byte = byte ? START_MARK : ESCAPE_MARK;
+				}
+				else if (byte == ESCAPE_MARK) {
+					_escape = true;
+					continue;
+				}
+				_current.push_back(byte);
+			}
+		}
+
+		void finish() {
+			if (_in_frame && !_current.empty()) {
+				frames.push_back(_current);
+			}
+			_current.clear();
+			_in_frame = false;
+		}
+
+		std::vector<payload> frames;
+		size_t bad_escapes = 0;
+
+	private:
+		payload _current;
+		bool _in_frame = false;
+		bool _escape = false;
+};
+
+struct result {
+	size_t sent = 0;
+	size_t received = 0;
+	size_t lost = 0;
+	size_t corrupt = 0;
+	size_t bytes = 0;
+	double seconds = 0;
+	std::vector<double> strobe_gaps;
+};
+
+/*
+ * Compares the received frames with the sent ones, in order.
+ */
+void match(const std::vector<payload>& sent, const std::vector<payload>& received, result& r) {
+	const size_t window = 64;
+	size_t next = 0;
+	for (auto& frame: received) {
+		size_t end = std::min(sent.size(), next + window);
+		auto it = std::find(sent.begin() + next, sent.begin() + end, frame);
+		if (it == sent.begin() + end) {
+			++r.corrupt;
+			continue;
+		}
+		const size_t found = size_t(it - sent.begin());
+		r.lost += found - next;
+		++r.received;
+		next = found + 1;
+	}
+	r.lost += sent.size() - next;
+}
+
+result run(const std::string& tx_path, const std::string& rx_path, unsigned baudrate,
+		size_t frame_count, size_t modules, std::mt19937& gen) {
+	auto tx = vlpp::bus::open_serial(tx_path, baudrate);
+	int rx = open(rx_path.c_str(), O_RDONLY | O_NOCTTY | O_NONBLOCK);
+	if (rx < 0) {
+		throw std::runtime_error("cannot open " + rx_path + ": " + std::strerror(errno));
+	}
+	vlpp::bus::configure_serial(rx, baudrate, rx_path);
+	tcflush(rx, TCIOFLUSH);
+
+	// read everything until the sender is done and the line stays quiet:
+	std::atomic<bool> done{false};
+	std::vector<uint8_t> received;
+	std::vector<bus_clock::time_point> strobes;
+	std::thread reader([&]{
+		uint8_t buffer[4096];
+		auto quiet_since = bus_clock::now();
+		while (!done || bus_clock::now() - quiet_since < std::chrono::milliseconds(200)) {
+			pollfd pfd = { rx, POLLIN, 0 };
+			if (poll(&pfd, 1, 10) <= 0) {
+				continue;
+			}
+			ssize_t n = read(rx, buffer, sizeof(buffer));
+			if (n <= 0) {
+				continue;
+			}
+			quiet_since = bus_clock::now();
+			received.insert(received.end(), buffer, buffer + n);
+			if (n >= 3 && buffer[n-3] == vlpp::bus::START_MARK &&
+					buffer[n-2] == vlpp::bus::BROADCAST_ADDRESS &&
+					buffer[n-1] == vlpp::bus::CMD_STROBE) {
+				strobes.push_back(quiet_since);
+			}
+		}
+	});
+
+	vlpp::bus::framer framer(*tx);
+	vlpp::bus::encoder encoder(framer);
+	std::uniform_int_distribution<int> dist(0, UINT16_MAX);
+	std::vector<payload> sent;
+	uint16_t values[vlpp::bus::MODULE_LENGTH];
+
+	auto start = bus_clock::now();
+	for (size_t f = 0; f < frame_count; ++f) {
+		// as fast as the line allows, like vapord does:
+		std::this_thread::sleep_until(tx->ready_at());
+		tx->drain();
+		for (size_t m = 0; m < modules; ++m) {
+			for (auto& v: values) {
+				v = uint16_t(dist(gen));
+			}
+			encoder.update(uint8_t(m), values, vlpp::bus::MODULE_LENGTH);
+			payload p = { uint8_t(m), vlpp::bus::CMD_SET_RAW };
+			for (auto v: values) {
+				p.push_back(uint8_t(v >> 8));
+				p.push_back(uint8_t(v & 0xff));
+			}
+			sent.push_back(p);
+		}
+		encoder.strobe();
+		sent.push_back({ vlpp::bus::BROADCAST_ADDRESS, vlpp::bus::CMD_STROBE });
+	}
+	while (tx->idle_at() > bus_clock::now()) {
+		std::this_thread::sleep_until(tx->ready_at());
+		tx->drain();
+	}
+	const auto end = tx->idle_at();
+	done = true;
+	reader.join();
+	close(rx);
+
+	receiver rcv;
+	rcv.feed(received.data(), received.size());
+	rcv.finish();
+
+	result r;
+	r.sent = sent.size();
+	r.bytes = received.size();
+	r.corrupt = rcv.bad_escapes;
+	r.seconds = std::chrono::duration<double>(end - start).count();
+	match(sent, rcv.frames, r);
+	for (size_t i = 1; i < strobes.size(); ++i) {
+		r.strobe_gaps.push_back(std::chrono::duration<double, std::micro>(strobes[i] - strobes[i-1]).count());
+	}
+	std::sort(r.strobe_gaps.begin(), r.strobe_gaps.end());
+	return r;
+}
+
+} //anonymous namespace
+
+/*
+ * Sends frames over a serial line and reads them back on another one
+ * (eg. two RS485-adapters on the same bus) to check that the bus works
+ * reliably at the given baudrates, and how close we get to the line rate.
+ */
+int main(int argc, char**argv) {
+	namespace bpo = boost::program_options;
+
+	std::string tx_path;
+	std::string rx_path;
+	std::vector<unsigned> baudrates;
+	size_t frames;
+	size_t modules;
+
+	try {
+		bpo::options_description desc;
+		desc.add_options()
+			("help,h", "print this help")
+			("tx,t", bpo::value<std::string>(&tx_path)->required(), "sets the tty to send on")
+			("rx,r", bpo::value<std::string>(&rx_path)->required(), "sets the tty to receive on")
+			("baudrate,b", bpo::value<std::vector<unsigned>>(&baudrates)->multitoken()
+				->default_value({500000, 1000000, 1500000}, "500000 1000000 1500000"),
+				"sets the baudrates to test")
+			("frames,n", bpo::value<size_t>(&frames)->default_value(1000), "sets the number of frames per baudrate")
+			("modules,m", bpo::value<size_t>(&modules)->default_value(4), "sets the number of modules per frame");
+
+		bpo::variables_map vm;
+		bpo::store(bpo::parse_command_line(argc, argv, desc), vm);
+		if (vm.count("help")) {
+			std::cout << desc << std::endl;
+			return 0;
+		}
+		bpo::notify(vm);
+
+		std::mt19937 gen(42);
+		bool ok = true;
+		for (auto baudrate: baudrates) {
+			auto r = run(tx_path, rx_path, baudrate, frames, modules, gen);
+			const double nominal = baudrate / 10.0;
+			std::cout << baudrate << " baud: " << r.received << "/" << r.sent << " frames, "
+			          << r.lost << " lost, " << r.corrupt << " corrupt, "
+			          << r.bytes / r.seconds / 1000 << " kB/s (" << 100 * r.bytes / r.seconds / nominal
+			          << "% of the line)";
+			if (!r.strobe_gaps.empty()) {
+				const auto& g = r.strobe_gaps;
+				std::cout << ", strobe interval median " << g[g.size() / 2] << " us, p99 "
+				          << g[g.size() * 99 / 100] << " us";
+			}
+			std::cout << std::endl;
+			ok = ok && r.lost == 0 && r.corrupt == 0;
+		}
+		return ok ? 0 : 2;
+	} catch (std::exception& e) {
+		std::cerr << "Error: " << e.what() << std::endl;
+		return 1;
+	}
+}
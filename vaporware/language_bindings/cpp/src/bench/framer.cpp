@@ -0,0 +1,125 @@
+/*
+ *  This file is part of vaporpp.
+ *
+ *  vaporpp is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vaporpp is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vaporpp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+#include "../bus/escape.hpp"
+#include "../bus/protocol.hpp"
+
+typedef std::chrono::steady_clock bench_clock;
+typedef size_t (*escape_function)(const uint8_t*, size_t, uint8_t*);
+
+namespace {
+
+/*
+ * Returns the throughput in MB of payload per second.
+ */
+double measure(escape_function f, const std::vector<std::vector<uint8_t>>& payloads, unsigned rounds) {
+	std::vector<uint8_t> out(vlpp::bus::max_escaped_size(payloads.front().size()));
+	size_t total = 0;
+	size_t checksum = 0;
+	auto start = bench_clock::now();
+	for (unsigned r = 0; r < rounds; ++r) {
+		for (auto& payload: payloads) {
+			checksum += f(payload.data(), payload.size(), out.data());
+			total += payload.size();
+		}
+	}
+	std::chrono::duration<double> duration = bench_clock::now() - start;
+	if (checksum == 0) {
+		throw std::logic_error("nothing escaped");
+	}
+	return total / duration.count() / 1e6;
+}
+
+std::vector<std::vector<uint8_t>> make_payloads(size_t count, size_t length,
+		std::uniform_int_distribution<int> dist, std::mt19937& gen) {
+	std::vector<std::vector<uint8_t>> returnval(count, std::vector<uint8_t>(length));
+	for (auto& payload: returnval) {
+		for (auto& byte: payload) {
+			byte = uint8_t(dist(gen));
+		}
+	}
+	return returnval;
+}
+
+} //anonymous namespace
+
+/*
+ * Measures the throughput of the bus escaping, bytewise and vectorized.
+ * test-escape checks that both give the same results.
+ */
+int main(int argc, char**argv) {
+	namespace bpo = boost::program_options;
+
+	unsigned rounds;
+	size_t modules;
+
+	try {
+		bpo::options_description desc;
+		desc.add_options()
+			("help,h", "print this help")
+			("rounds,r", bpo::value<unsigned>(&rounds)->default_value(2000), "sets the number of rounds")
+			("modules,m", bpo::value<size_t>(&modules)->default_value(60),
+				"sets the number of SET_RAW frames per round");
+
+		bpo::variables_map vm;
+		bpo::store(bpo::parse_command_line(argc, argv, desc), vm);
+		bpo::notify(vm);
+
+		if (vm.count("help")) {
+			std::cout << desc << std::endl;
+			return 0;
+		}
+		if (modules == 0) {
+			throw std::invalid_argument("need at least one module");
+		}
+
+		std::mt19937 gen(42);
+		const size_t frame_length = 2 + 2 * vlpp::bus::MODULE_LENGTH;
+
+		struct scenario {
+			const char* name;
+			std::uniform_int_distribution<int> dist;
+		};
+		const scenario scenarios[] = {
+			{"random 16-bit values", std::uniform_int_distribution<int>(0, 255)},
+			{"no marks            ", std::uniform_int_distribution<int>(0x56, 255)},
+			{"only marks          ", std::uniform_int_distribution<int>(0x54, 0x55)},
+		};
+		for (auto& s: scenarios) {
+			auto payloads = make_payloads(modules, frame_length, s.dist, gen);
+			double bytewise = measure(vlpp::bus::escape_bytewise, payloads, rounds);
+			double fast = measure(vlpp::bus::escape, payloads, rounds);
+			std::cout << s.name << ": bytewise " << bytewise << " MB/s, escape "
+			          << fast << " MB/s (x" << fast / bytewise << ")" << std::endl;
+		}
+		return 0;
+	} catch (std::exception& e) {
+		std::cerr << "Error: " << e.what() << std::endl;
+		return 1;
+	}
+}
@@ -0,0 +1,184 @@
+/*
+ *  This file is part of vaporpp.
+ *
+ *  vaporpp is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vaporpp is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vaporpp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/program_options.hpp>
+
+using boost::asio::ip::tcp;
+typedef std::chrono::steady_clock bench_clock;
+
+namespace {
+
+/*
+ * Scans the bus traffic for a broadcast strobe (START_MARK 0xff 0xff).
+ */
+class strobe_scanner {
+	public:
+		bool feed(uint8_t byte) {
+			if (byte == 0x55) {
+				_state = 1;
+			}
+			else if (byte == 0xff && _state > 0) {
+				if (++_state == 3) {
+					_state = 0;
+					return true;
+				}
+			}
+			else {
+				_state = 0;
+			}
+			return false;
+		}
+	private:
+		int _state = 0;
+};
+
+double percentile(const std::vector<double>& sorted, double p) {
+	return sorted[std::min(sorted.size() - 1, size_t(p * sorted.size()))];
+}
+
+} //anonymous namespace
+
+/*
+ * Measures the socket-to-bus latency of a daemon.
+ *
+ * The daemon must be configured to use a network device pointing to
+ * this program (like it would for the emulator). Each round sends one
+ * LED-update and a strobe and waits until the strobe appears on the bus.
+ * This works with the scala daemon as well as with vapord.
+ */
+int main(int argc, char**argv) {
+	using std::string;
+	namespace bpo = boost::program_options;
+
+	string server;
+	string token;
+	uint16_t port;
+	uint16_t bus_port;
+	uint16_t led;
+	unsigned frames;
+
+	try {
+		bpo::options_description desc;
+		desc.add_options()
+			("help,h", "print this help")
+			("token,t", bpo::value<string>(&token), "sets the authentication-token")
+			("server,s", bpo::value<string>(&server)->default_value("localhost"), "sets the servername")
+			("port,p", bpo::value<uint16_t>(&port)->default_value(7534), "sets the server-port")
+			("bus-port,b", bpo::value<uint16_t>(&bus_port)->default_value(23429),
+				"sets the port the daemon's bus-device connects to")
+			("led,l", bpo::value<uint16_t>(&led)->default_value(0), "sets the LED that is toggled")
+			("frames,n", bpo::value<unsigned>(&frames)->default_value(1000), "sets the number of frames");
+
+		bpo::variables_map vm;
+		bpo::store(bpo::parse_command_line(argc, argv, desc), vm);
+		bpo::notify(vm);
+
+		if (vm.count("help")) {
+			std::cout << desc << std::endl;
+			return 0;
+		}
+		if (frames == 0) {
+			throw std::invalid_argument("need at least one frame");
+		}
+		token.resize(16, '\0');
+
+		boost::asio::io_service io;
+		tcp::acceptor acceptor(io, tcp::endpoint(tcp::v4(), bus_port));
+		tcp::socket bus(io);
+		std::cout << "waiting for the daemon to connect its bus to port " << bus_port << std::endl;
+		acceptor.accept(bus);
+
+		// the daemon opens its bus before it starts listening, so give it a moment:
+		tcp::socket client(io);
+		tcp::resolver resolver(io);
+		auto endpoints = resolver.resolve(tcp::resolver::query(server, std::to_string(port)));
+		for (int attempt = 0; ; ++attempt) {
+			boost::system::error_code e;
+			boost::asio::connect(client, endpoints, e);
+			if (!e) {
+				break;
+			}
+			if (attempt == 50) {
+				throw std::runtime_error("cannot connect to the daemon: " + e.message());
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		}
+		client.set_option(tcp::no_delay(true));
+
+		std::vector<uint8_t> auth{0x02};
+		auth.insert(auth.end(), token.begin(), token.end());
+		boost::asio::write(client, boost::asio::buffer(auth));
+
+		strobe_scanner scanner;
+		std::array<uint8_t, 4096> buffer;
+		std::vector<double> latencies;
+		latencies.reserve(frames);
+		uint64_t bus_bytes = 0;
+		auto start = bench_clock::now();
+
+		for (unsigned i = 0; i < frames; ++i) {
+			// alternate the color, so that every frame changes something:
+			uint8_t value = (i % 2) ? 0xff : 0x00;
+			// set-led-16 and strobe:
+			const std::array<uint8_t, 12> frame = {{
+				0x03, uint8_t(led >> 8), uint8_t(led & 0xff),
+				value, value, value, value, value, value, 0xff, 0xff,
+				0xff
+			}};
+
+			auto sent = bench_clock::now();
+			boost::asio::write(client, boost::asio::buffer(frame));
+
+			bool seen = false;
+			while (!seen) {
+				size_t length = bus.read_some(boost::asio::buffer(buffer));
+				bus_bytes += length;
+				for (size_t j = 0; j < length; ++j) {
+					seen = scanner.feed(buffer[j]) || seen;
+				}
+			}
+			std::chrono::duration<double, std::micro> latency = bench_clock::now() - sent;
+			latencies.push_back(latency.count());
+		}
+
+		std::chrono::duration<double> total = bench_clock::now() - start;
+		std::sort(latencies.begin(), latencies.end());
+		std::cout << "frames:      " << frames << "\n"
+		          << "bus bytes:   " << bus_bytes << "\n"
+		          << "frames/s:    " << frames / total.count() << "\n"
+		          << "latency/us:  min " << latencies.front()
+		          << ", median " << percentile(latencies, 0.5)
+		          << ", p99 " << percentile(latencies, 0.99)
+		          << ", max " << latencies.back() << std::endl;
+		return 0;
+	} catch (std::exception& e) {
+		std::cerr << "Error: " << e.what() << std::endl;
+		return 1;
+	}
+}
@@ -0,0 +1,50 @@
+/*
+ *  This file is part of vaporpp.
+ *
+ *  vaporpp is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vaporpp is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vaporpp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "channel_map.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#include "protocol.hpp"
+
+void vlpp::bus::channel_map::add_module(uint8_t module, unsigned channels, size_t bus) {
+	if (channels > MODULE_LENGTH) {
+		throw std::invalid_argument("module " + std::to_string(module) + " has too many channels");
+	}
+	_modules[module] = module_info{channels, bus};
+	_bus_count = std::max(_bus_count, bus + 1);
+}
+
+void vlpp::bus::channel_map::assign(uint16_t led, const led_channels& channels) {
+	for (auto& channel: channels) {
+		if (!channel.used) {
+			continue;
+		}
+		auto module = _modules.find(channel.module);
+		if (module == _modules.end() || channel.position >= module->second.channels) {
+			throw std::invalid_argument("LED " + std::to_string(led) +
+					" is mapped to a nonexistent channel");
+		}
+	}
+	if (led >= _leds.size()) {
+		_leds.resize(size_t(led) + 1);
+	}
+	_leds[led] = channels;
+}
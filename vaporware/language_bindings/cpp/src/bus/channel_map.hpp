@@ -0,0 +1,104 @@
+/*
+ *  This file is part of vaporpp.
+ *
+ *  vaporpp is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vaporpp is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vaporpp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef BUS_CHANNEL_MAP_HPP
+#define BUS_CHANNEL_MAP_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+namespace vlpp {
+namespace bus {
+
+/**
+ * @brief A hardware channel: a module-address and a position on the module.
+ */
+struct channel_address {
+	bool used = false;
+	uint8_t module = 0;
+	uint8_t position = 0;
+};
+
+/**
+ * @brief The red, green and blue hardware channel of one LED.
+ */
+typedef std::array<channel_address, 3> led_channels;
+
+/**
+ * @brief Maps virtual RGB-LEDs to the channels of the hardware modules.
+ *
+ * This is the C++-counterpart of the channel table of Mapping.scala.
+ */
+class channel_map {
+	public:
+		/**
+		 * @brief The properties of a module.
+		 */
+		struct module_info {
+			/// the number of channels the module has
+			unsigned channels;
+			/// the index of the bus the module is connected to
+			size_t bus;
+		};
+
+		/**
+		 * @brief Declares a module.
+		 * @param module the address of the module
+		 * @param channels the number of channels the module has
+		 * @param bus the index of the bus the module is connected to
+		 * @throws std::invalid_argument if the module has more than MODULE_LENGTH channels
+		 */
+		void add_module(uint8_t module, unsigned channels, size_t bus = 0);
+
+		/**
+		 * @brief Maps a LED to hardware channels.
+		 * @throws std::invalid_argument if a channel does not exist on its module
+		 */
+		void assign(uint16_t led, const led_channels& channels);
+
+		/**
+		 * @brief Returns the channels of a LED or nullptr if it is not mapped.
+		 */
+		const led_channels* find(uint16_t led) const {
+			return led < _leds.size() ? &_leds[led] : nullptr;
+		}
+
+		/**
+		 * @brief Returns all modules by address.
+		 */
+		const std::map<uint8_t, module_info>& modules() const { return _modules; }
+
+		/**
+		 * @brief Returns the number of buses the modules are spread over.
+		 */
+		size_t bus_count() const { return _bus_count; }
+
+	private:
+		// indexed by LED-ID; unmapped LEDs have no used channels:
+		std::vector<led_channels> _leds;
+		std::map<uint8_t, module_info> _modules;
+		size_t _bus_count = 1;
+};
+
+}//namespace bus
+}//namespace vlpp
+
+#endif // BUS_CHANNEL_MAP_HPP
@@ -0,0 +1,59 @@
+/*
+ *  This file is part of vaporpp.
+ *
+ *  vaporpp is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vaporpp is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vaporpp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "custom_baudrate.hpp"
+
+#include "device.hpp"
+
+#if defined(__linux__)
+
+#include <cerrno>
+#include <cstring>
+
+#include <asm/termbits.h>
+#include <sys/ioctl.h>
+
+void vlpp::bus::set_custom_baudrate(int fd, unsigned baudrate, const std::string& name) {
+	termios2 tio;
+	if (ioctl(fd, TCGETS2, &tio) < 0) {
+		throw bus_error("cannot configure " + name + ": " + std::strerror(errno));
+	}
+	tio.c_cflag &= ~CBAUD;
+	tio.c_cflag |= BOTHER;
+	tio.c_ispeed = baudrate;
+	tio.c_ospeed = baudrate;
+	if (ioctl(fd, TCSETS2, &tio) < 0 || ioctl(fd, TCGETS2, &tio) < 0) {
+		throw bus_error("cannot set baudrate of " + name + ": " + std::strerror(errno));
+	}
+	// the driver picks the closest rate it can generate; the boards
+	// tolerate a few percent in total, so we may use half of that:
+	const unsigned deviation = tio.c_ospeed > baudrate ?
+		tio.c_ospeed - baudrate : baudrate - tio.c_ospeed;
+	if (deviation * 1000ull > baudrate * 15ull) {
+		throw bus_error(name + " cannot generate " + std::to_string(baudrate) +
+				" baud (got " + std::to_string(tio.c_ospeed) + ")");
+	}
+}
+
+#else
+
+void vlpp::bus::set_custom_baudrate(int, unsigned baudrate, const std::string&) {
+	throw bus_error("unsupported baudrate: " + std::to_string(baudrate));
+}
+
+#endif
@@ -0,0 +1,39 @@
+/*
+ *  This file is part of vaporpp.
+ *
+ *  vaporpp is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vaporpp is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vaporpp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef BUS_CUSTOM_BAUDRATE_HPP
+#define BUS_CUSTOM_BAUDRATE_HPP
+
+#include <string>
+
+namespace vlpp {
+namespace bus {
+
+/*
+ * Sets a baudrate that has no Bxxx-constant on a tty.
+ *
+ * This needs termios2, which can't be included together with <termios.h>,
+ * hence the separate file. Throws bus_error if the port doesn't support
+ * the baudrate or the platform doesn't support custom baudrates.
+ */
+void set_custom_baudrate(int fd, unsigned baudrate, const std::string& name);
+
+}//namespace bus
+}//namespace vlpp
+
+#endif // BUS_CUSTOM_BAUDRATE_HPP
@@ -0,0 +1,259 @@
+/*
+ *  This file is part of vaporpp.
+ *
+ *  vaporpp is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vaporpp is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vaporpp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "device.hpp"
+
+#include "custom_baudrate.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace {
+
+// all our devices are plain file-descriptors:
+class fd_device : public vlpp::bus::device {
+	public:
+		fd_device(int fd, const std::string& name): _fd(fd), _name(name) {}
+		~fd_device();
+		void write(const uint8_t* data, size_t length) override;
+	protected:
+		// returns the number of bytes the kernel took:
+		size_t write_some(const uint8_t* data, size_t length);
+
+		int _fd;
+		std::string _name;
+};
+
+// a non-blocking serial port that knows how long its frames take on the wire:
+class serial_device : public fd_device {
+	public:
+		serial_device(int fd, const std::string& name, unsigned baudrate):
+			fd_device(fd, name), _baudrate(baudrate) {}
+		void write(const uint8_t* data, size_t length) override;
+		vlpp::bus::bus_clock::time_point ready_at() const override;
+		vlpp::bus::bus_clock::time_point idle_at() const override { return _idle_at; }
+		void drain() override;
+		size_t pending() const override { return _pending.size(); }
+	private:
+		unsigned _baudrate;
+		// when the line will be idle, if our estimate is right:
+		vlpp::bus::bus_clock::time_point _idle_at;
+		// what the kernel didn't take yet:
+		std::vector<uint8_t> _pending;
+};
+
+// The next frame is handed over a bit before the line becomes idle, to
+// cover the latency of USB-serial adapters and the jitter of our wakeups;
+// at 500 kBaud, this is 50 bytes of queue at most.
+const auto HANDOVER_TIME = std::chrono::milliseconds(1);
+
+std::string errno_string(const std::string& what, const std::string& name) {
+	return what + " " + name + ": " + std::strerror(errno);
+}
+
+// returns B0 for baudrates that have to be set with set_custom_baudrate():
+speed_t baudrate_to_speed(unsigned baudrate) {
+	switch (baudrate) {
+		case 9600: return B9600;
+		case 19200: return B19200;
+		case 38400: return B38400;
+		case 57600: return B57600;
+		case 115200: return B115200;
+		case 230400: return B230400;
+		case 460800: return B460800;
+		case 500000: return B500000;
+		case 576000: return B576000;
+		case 921600: return B921600;
+		case 1000000: return B1000000;
+		case 1152000: return B1152000;
+		case 1500000: return B1500000;
+		default: return B0;
+	}
+}
+
+} //anonymous namespace
+
+vlpp::bus::device::~device() {}
+
+vlpp::bus::bus_clock::time_point vlpp::bus::device::ready_at() const {
+	return bus_clock::now();
+}
+
+vlpp::bus::bus_clock::time_point vlpp::bus::device::idle_at() const {
+	return bus_clock::now();
+}
+
+void vlpp::bus::device::drain() {}
+
+size_t vlpp::bus::device::pending() const {
+	return 0;
+}
+
+fd_device::~fd_device() {
+	close(_fd);
+}
+
+void fd_device::write(const uint8_t* data, size_t length) {
+	++_stats.frames;
+	_stats.bytes += length;
+	// the descriptor is blocking, so write_some() takes everything:
+	write_some(data, length);
+}
+
+size_t fd_device::write_some(const uint8_t* data, size_t length) {
+	size_t total = 0;
+	while (total < length) {
+		ssize_t written = ::write(_fd, data + total, length - total);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+			throw vlpp::bus::bus_error(errno_string("cannot write to", _name));
+		}
+		total += (size_t)written;
+	}
+	return total;
+}
+
+void serial_device::write(const uint8_t* data, size_t length) {
+	using vlpp::bus::bus_clock;
+	// older data has to go first:
+	drain();
+	if (_pending.size() + length > vlpp::bus::MAX_PENDING_BYTES) {
+		throw vlpp::bus::bus_error(_name + " does not take any data");
+	}
+
+	const auto duration = vlpp::bus::wire_time(length, _baudrate);
+	_idle_at = std::max(bus_clock::now(), _idle_at) + duration;
+	++_stats.frames;
+	_stats.bytes += length;
+	_stats.busy += duration;
+
+	if (_pending.empty()) {
+		size_t written = write_some(data, length);
+		data += written;
+		length -= written;
+	}
+	_pending.insert(_pending.end(), data, data + length);
+}
+
+vlpp::bus::bus_clock::time_point serial_device::ready_at() const {
+	// if the kernel doesn't take our data, the line is slower than we think:
+	const auto pending_until = vlpp::bus::bus_clock::now() +
+		vlpp::bus::wire_time(_pending.size(), _baudrate);
+	return std::max(_idle_at, pending_until) - HANDOVER_TIME;
+}
+
+void serial_device::drain() {
+	if (_pending.empty()) {
+		return;
+	}
+	size_t written = write_some(_pending.data(), _pending.size());
+	_pending.erase(_pending.begin(), _pending.begin() + written);
+}
+
+void vlpp::bus::configure_serial(int fd, unsigned baudrate, const std::string& name) {
+	if (baudrate == 0 || baudrate > MAX_BAUDRATE) {
+		throw bus_error("the boards can't receive " + std::to_string(baudrate) + " baud on " + name +
+				" (1 to " + std::to_string(MAX_BAUDRATE) + ")");
+	}
+	speed_t speed = baudrate_to_speed(baudrate);
+	termios tio;
+	if (tcgetattr(fd, &tio) < 0) {
+		throw bus_error(errno_string("cannot configure", name));
+	}
+	cfmakeraw(&tio);
+	// 8N1, no flow control:
+	tio.c_cflag &= ~(CSTOPB | PARENB | CRTSCTS);
+	tio.c_cflag |= CLOCAL | CREAD | CS8;
+	if (speed != B0) {
+		cfsetispeed(&tio, speed);
+		cfsetospeed(&tio, speed);
+	}
+	if (tcsetattr(fd, TCSANOW, &tio) < 0) {
+		throw bus_error(errno_string("cannot configure", name));
+	}
+	if (speed == B0) {
+		set_custom_baudrate(fd, baudrate, name);
+	}
+}
+
+std::unique_ptr<vlpp::bus::device> vlpp::bus::open_serial(const std::string& path, unsigned baudrate) {
+	int fd = open(path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (fd < 0) {
+		throw bus_error(errno_string("cannot open", path));
+	}
+	std::unique_ptr<device> dev(new serial_device(fd, path, baudrate));
+	// this rejects the baudrates the device can't compute wire times for:
+	configure_serial(fd, baudrate, path);
+	return dev;
+}
+
+std::unique_ptr<vlpp::bus::device> vlpp::bus::open_socket(const std::string& host, uint16_t port) {
+	addrinfo hints;
+	std::memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	addrinfo* results = nullptr;
+	auto name = host + ":" + std::to_string(port);
+	if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &results) != 0) {
+		throw bus_error("cannot resolve " + name);
+	}
+	int fd = -1;
+	for (auto ai = results; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0) {
+			continue;
+		}
+		if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+			// frames are written in one piece, don't let them wait:
+			int one = 1;
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+			break;
+		}
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(results);
+	if (fd < 0) {
+		throw bus_error("cannot connect to " + name);
+	}
+	return std::unique_ptr<device>(new fd_device(fd, name));
+}
+
+std::unique_ptr<vlpp::bus::device> vlpp::bus::open_file(const std::string& path) {
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		throw bus_error(errno_string("cannot open", path));
+	}
+	return std::unique_ptr<device>(new fd_device(fd, path));
+}
@@ -0,0 +1,193 @@
+/*
+ *  This file is part of vaporpp.
+ *
+ *  vaporpp is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vaporpp is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vaporpp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef BUS_DEVICE_HPP
+#define BUS_DEVICE_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+namespace vlpp {
+namespace bus {
+
+typedef std::chrono::steady_clock bus_clock;
+
+/**
+ * @brief What has been written to a device so far.
+ */
+struct statistics {
+	/// the number of writes; the framer writes one per strobe
+	uint64_t frames = 0;
+	/// the number of bytes written
+	uint64_t bytes = 0;
+	/// the time the line was busy transmitting; only known for serial ports
+	bus_clock::duration busy = bus_clock::duration::zero();
+};
+
+/**
+ * @brief The fastest baudrate the LED boards can receive.
+ *
+ * Their USARTs run from 24MHz with 16x oversampling (see BUS_BAUDRATE in
+ * the Makefile of the firmware).
+ */
+const unsigned MAX_BAUDRATE = 1500000;
+
+/**
+ * @brief Returns the time a number of bytes take on a serial line (8N1).
+ */
+inline bus_clock::duration wire_time(size_t bytes, unsigned baudrate) {
+	// start-bit, eight data-bits, stop-bit:
+	const uint64_t bits = 10 * uint64_t(bytes);
+	return std::chrono::duration_cast<bus_clock::duration>(
+			std::chrono::nanoseconds(bits * 1000000000ull / baudrate));
+}
+
+/**
+ * @brief The most bytes a serial port keeps that the kernel didn't take.
+ *
+ * That is more than a second of traffic at 500000 baud; a port that is
+ * this far behind is not transmitting at all.
+ */
+const size_t MAX_PENDING_BYTES = 64 * 1024;
+
+/**
+ * @brief Something the framed bus traffic can be written to.
+ *
+ * This is the C++-counterpart of the OutputStreams created by
+ * Physical.scala in the daemon.
+ */
+class device {
+	public:
+		virtual ~device();
+
+		/**
+		 * @brief Writes all of the given bytes to the device.
+		 * @param data the bytes
+		 * @param length the number of bytes
+		 * @throws vlpp::bus::bus_error if the write fails
+		 */
+		virtual void write(const uint8_t* data, size_t length) = 0;
+
+		/**
+		 * @brief Returns when the device can take the next frame without queueing it.
+		 *
+		 * Devices that don't know their speed are always ready.
+		 * @throws vlpp::bus::bus_error if the device failed for good
+		 */
+		virtual bus_clock::time_point ready_at() const;
+
+		/**
+		 * @brief Returns when everything written so far will have left the device.
+		 *
+		 * Devices that don't know their speed are always idle.
+		 */
+		virtual bus_clock::time_point idle_at() const;
+
+		/**
+		 * @brief Continues writing data the device could not take yet.
+		 * @throws vlpp::bus::bus_error if the write fails
+		 */
+		virtual void drain();
+
+		/**
+		 * @brief Returns the number of bytes written that the device could not take yet.
+		 *
+		 * They go out before anything written later, so a caller that renders
+		 * frames should wait until this is 0 instead of queueing behind them.
+		 * Devices that don't know their speed never keep anything.
+		 * @throws vlpp::bus::bus_error if the device failed for good
+		 */
+		virtual size_t pending() const;
+
+		/**
+		 * @brief Returns what has been written so far.
+		 */
+		virtual statistics stats() const { return _stats; }
+
+	protected:
+		statistics _stats;
+};
+
+/**
+ * @brief Opens a serial port (8N1, raw mode).
+ *
+ * The port is non-blocking: write() hands as much as possible to the
+ * kernel and keeps the rest until the next write() or drain(). The device
+ * keeps track of how long the line will be busy with the data written so
+ * far, so that ready_at() tells the caller when to send the next frame;
+ * a caller that waits for it and for pending() to be 0 never builds up a
+ * queue of stale frames. If more than MAX_PENDING_BYTES pile up anyway,
+ * write() throws.
+ *
+ * @param path the path of the tty, eg "/dev/ttyUSB0"
+ * @param baudrate the baudrate, up to MAX_BAUDRATE; rates without a
+ *        Bxxx-constant (eg 1200000) are set with termios2 on Linux
+ * @throws vlpp::bus::bus_error if the port cannot be opened or configured,
+ *         or the boards can't receive the baudrate
+ */
+std::unique_ptr<device> open_serial(const std::string& path, unsigned baudrate);
+
+/**
+ * @brief Puts a tty into raw mode with 8N1 and the given baudrate.
+ *
+ * open_serial() does this; it is only needed for ttys that are not written
+ * through a device, eg. to read back the bus.
+ *
+ * @param fd the file-descriptor of the tty
+ * @param baudrate the baudrate, up to MAX_BAUDRATE
+ * @param name the name of the tty for error-messages
+ * @throws vlpp::bus::bus_error if the tty cannot be configured, or the
+ *         boards can't receive the baudrate
+ */
+void configure_serial(int fd, unsigned baudrate, const std::string& name);
+
+/**
+ * @brief Connects to a TCP server (usually the vaporlight emulator).
+ * @param host the hostname or ip-address
+ * @param port the port
+ * @throws vlpp::bus::bus_error if no connection could be created
+ */
+std::unique_ptr<device> open_socket(const std::string& host, uint16_t port);
+
+/**
+ * @brief Opens a file for writing. Only useful for debugging.
+ * @param path the path of the file; it will be truncated
+ * @throws vlpp::bus::bus_error if the file cannot be opened
+ */
+std::unique_ptr<device> open_file(const std::string& path);
+
+/**
+ * @brief Exception that will be thrown if a bus device fails
+ */
+class bus_error : public std::runtime_error {
+	public:
+		/**
+		 * @brief The usual exception ctor.
+		 * @param msg the error-message
+		 */
+		bus_error(const std::string& msg) : std::runtime_error(msg){}
+};
+
+}//namespace bus
+}//namespace vlpp
+
+#endif // BUS_DEVICE_HPP
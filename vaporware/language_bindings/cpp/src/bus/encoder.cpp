@@ -0,0 +1,161 @@
+/*
+ *  This file is part of vaporpp.
+ *
+ *  vaporpp is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vaporpp is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vaporpp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "encoder.hpp"
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+#include <vector>
+
+#include "protocol.hpp"
+
+vlpp::bus::encoder::encoder(framer& fr):
+	_framer(fr) {
+}
+
+void vlpp::bus::encoder::update(uint8_t module, const uint16_t* values, size_t count) {
+	if (count > MODULE_LENGTH) {
+		throw std::invalid_argument("too many channels for one module");
+	}
+	// the modules only take all channels at once:
+	std::array<uint8_t, 2 + 2 * MODULE_LENGTH> payload{};
+	payload[0] = module;
+	payload[1] = CMD_SET_RAW;
+	for (size_t i = 0; i < count; ++i) {
+		payload[2 + 2*i] = (uint8_t)(values[i] >> 8);
+		payload[3 + 2*i] = (uint8_t)(values[i] & 0xff);
+	}
+	_framer.write(payload.data(), payload.size());
+}
+
+void vlpp::bus::encoder::update(uint8_t module, const uint8_t* values, size_t count) {
+	if (count > MODULE_LENGTH) {
+		throw std::invalid_argument("too many channels for one module");
+	}
+	std::array<uint8_t, 2 + MODULE_LENGTH> payload{};
+	payload[0] = module;
+	payload[1] = CMD_SET_RAW8;
+	std::copy(values, values + count, payload.begin() + 2);
+	_framer.write(payload.data(), payload.size());
+}
+
+size_t vlpp::bus::encoder::update_changed_size(uint16_t changed) {
+	const size_t count = size_t(__builtin_popcount(changed));
+	// SET_SPARSE needs two bytes for the mask:
+	return std::min(4 + 2 * count, 2 + 2 * size_t(MODULE_LENGTH));
+}
+
+void vlpp::bus::encoder::update_changed(uint8_t module, const uint16_t* values, uint16_t changed) {
+	if (update_changed_size(changed) == 2 + 2 * MODULE_LENGTH) {
+		update(module, values, MODULE_LENGTH);
+		return;
+	}
+	std::array<uint8_t, 4 + 2 * MODULE_LENGTH> payload;
+	payload[0] = module;
+	payload[1] = CMD_SET_SPARSE;
+	payload[2] = (uint8_t)(changed >> 8);
+	payload[3] = (uint8_t)(changed & 0xff);
+	size_t length = 4;
+	for (size_t i = 0; i < MODULE_LENGTH; ++i) {
+		if (changed & (1u << i)) {
+			payload[length++] = (uint8_t)(values[i] >> 8);
+			payload[length++] = (uint8_t)(values[i] & 0xff);
+		}
+	}
+	_framer.write(payload.data(), length);
+}
+
+size_t vlpp::bus::encoder::update_bulk_size(size_t modules) {
+	return 4 + 2 * MODULE_LENGTH * modules;
+}
+
+void vlpp::bus::encoder::update_bulk(uint8_t first, const uint16_t* values, size_t modules) {
+	if (modules == 0 || first + modules > BROADCAST_ADDRESS) {
+		throw std::invalid_argument("invalid range of modules");
+	}
+	std::vector<uint8_t> payload(update_bulk_size(modules));
+	payload[0] = BROADCAST_ADDRESS;
+	payload[1] = CMD_BULK_RAW;
+	payload[2] = first;
+	payload[3] = uint8_t(modules);
+	for (size_t i = 0; i < MODULE_LENGTH * modules; ++i) {
+		payload[4 + 2*i] = (uint8_t)(values[i] >> 8);
+		payload[5 + 2*i] = (uint8_t)(values[i] & 0xff);
+	}
+	_framer.write(payload.data(), payload.size());
+}
+
+void vlpp::bus::encoder::fade(uint8_t module, const uint16_t* values, size_t count,
+		std::chrono::milliseconds duration) {
+	if (count > MODULE_LENGTH) {
+		throw std::invalid_argument("too many channels for one module");
+	}
+	if (duration.count() < 0 || duration.count() > 0xffff) {
+		throw std::invalid_argument("fade duration out of range");
+	}
+	const auto ms = uint16_t(duration.count());
+	std::array<uint8_t, 4 + 2 * MODULE_LENGTH> payload{};
+	payload[0] = module;
+	payload[1] = CMD_FADE_RAW;
+	payload[2] = (uint8_t)(ms >> 8);
+	payload[3] = (uint8_t)(ms & 0xff);
+	for (size_t i = 0; i < count; ++i) {
+		payload[4 + 2*i] = (uint8_t)(values[i] >> 8);
+		payload[5 + 2*i] = (uint8_t)(values[i] & 0xff);
+	}
+	_framer.write(payload.data(), payload.size());
+}
+
+void vlpp::bus::encoder::strobe() {
+	const uint8_t payload[] = { BROADCAST_ADDRESS, CMD_STROBE };
+	_framer.write(payload, sizeof(payload));
+	_framer.flush();
+}
+
+void vlpp::bus::encoder::time_sync(std::chrono::milliseconds time) {
+	write_time(CMD_TIME_SYNC, time);
+}
+
+void vlpp::bus::encoder::strobe_at(std::chrono::milliseconds time) {
+	write_time(CMD_STROBE_AT, time);
+}
+
+void vlpp::bus::encoder::enter_config_mode(uint8_t module) {
+	if (module == BROADCAST_ADDRESS) {
+		throw std::invalid_argument("modules can't enter config mode all at once");
+	}
+	const uint8_t payload[] = {
+		module, CMD_CONFIG_MODE,
+		uint8_t(CONFIG_MODE_KEY >> 24), uint8_t(CONFIG_MODE_KEY >> 16),
+		uint8_t(CONFIG_MODE_KEY >> 8), uint8_t(CONFIG_MODE_KEY)
+	};
+	_framer.write(payload, sizeof(payload));
+	_framer.flush();
+}
+
+void vlpp::bus::encoder::write_time(uint8_t command, std::chrono::milliseconds time) {
+	// The board time wraps around, the modules compare it modulo 2^32:
+	const auto ms = uint32_t(time.count());
+	const uint8_t payload[] = {
+		BROADCAST_ADDRESS, command,
+		uint8_t(ms >> 24), uint8_t(ms >> 16), uint8_t(ms >> 8), uint8_t(ms)
+	};
+	_framer.write(payload, sizeof(payload));
+	_framer.flush();
+}
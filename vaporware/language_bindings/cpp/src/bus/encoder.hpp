@@ -0,0 +1,176 @@
+/*
+ *  This file is part of vaporpp.
+ *
+ *  vaporpp is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vaporpp is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vaporpp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef BUS_ENCODER_HPP
+#define BUS_ENCODER_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include "framer.hpp"
+
+namespace vlpp {
+namespace bus {
+
+/**
+ * @brief Translates bus commands into frames.
+ */
+class encoder {
+	public:
+		/**
+		 * @brief Creates an encoder that writes to the given framer.
+		 * @param fr the framer; it must outlive the encoder
+		 */
+		explicit encoder(framer& fr);
+
+		/**
+		 * @brief Sends a SET_RAW command to a module.
+		 *
+		 * The command always carries all MODULE_LENGTH channels; the ones
+		 * after the given values are set to 0.
+		 *
+		 * @param module the address of the module
+		 * @param values the PWM values of the channels
+		 * @param count the number of values, at most MODULE_LENGTH
+		 * @throws std::invalid_argument if there are too many values
+		 */
+		void update(uint8_t module, const uint16_t* values, size_t count);
+
+		/**
+		 * @brief Sends a SET_RAW8 command to a module.
+		 *
+		 * The module expands the values to PWM values with its
+		 * configured gamma curve. Like update(), this sets the channels
+		 * after the given values to 0.
+		 *
+		 * @param module the address of the module
+		 * @param values the 8 bit values of the channels
+		 * @param count the number of values, at most MODULE_LENGTH
+		 * @throws std::invalid_argument if there are too many values
+		 */
+		void update(uint8_t module, const uint8_t* values, size_t count);
+
+		/**
+		 * @brief Sends the changed channels of a module.
+		 *
+		 * Sends a SET_SPARSE command with only the changed channels,
+		 * or a SET_RAW command with all of them, whichever is shorter.
+		 *
+		 * @param module the address of the module
+		 * @param values the PWM values of all MODULE_LENGTH channels
+		 * @param changed the channels that changed, bit i for channel i
+		 */
+		void update_changed(uint8_t module, const uint16_t* values, uint16_t changed);
+
+		/**
+		 * @brief Returns the length of the payload update_changed() sends.
+		 */
+		static size_t update_changed_size(uint16_t changed);
+
+		/**
+		 * @brief Sends a BULK_RAW command to a range of modules.
+		 *
+		 * One frame carries all MODULE_LENGTH channels of each
+		 * module from first to first + modules - 1.
+		 *
+		 * @param first the address of the first module
+		 * @param values modules * MODULE_LENGTH PWM values, module by module
+		 * @param modules the number of modules
+		 * @throws std::invalid_argument if the range of addresses is invalid
+		 */
+		void update_bulk(uint8_t first, const uint16_t* values, size_t modules);
+
+		/**
+		 * @brief Returns the length of the payload update_bulk() sends.
+		 */
+		static size_t update_bulk_size(size_t modules);
+
+		/**
+		 * @brief Sends a FADE_RAW command to a module.
+		 *
+		 * With the next strobe, the module fades from its current
+		 * values to the given ones on its own. The channels after the
+		 * given values fade to 0.
+		 *
+		 * @param module the address of the module
+		 * @param values the PWM values of the channels at the end of the fade
+		 * @param count the number of values, at most MODULE_LENGTH
+		 * @param duration the duration of the fade, at most 65535ms
+		 * @throws std::invalid_argument if there are too many values or the
+		 *         duration is out of range
+		 */
+		void fade(uint8_t module, const uint16_t* values, size_t count,
+				std::chrono::milliseconds duration);
+
+		/**
+		 * @brief Sends a broadcast STROBE and flushes the framer.
+		 * @throws vlpp::bus::bus_error if the write fails
+		 */
+		void strobe();
+
+		/**
+		 * @brief Sets the board time of all modules and flushes the framer.
+		 *
+		 * The modules count the time in milliseconds from here on. Their
+		 * clocks drift apart slowly, so the time should be synchronized
+		 * again every few seconds.
+		 *
+		 * @param time the new board time; only its lower 32 bits are sent
+		 * @throws vlpp::bus::bus_error if the write fails
+		 */
+		void time_sync(std::chrono::milliseconds time);
+
+		/**
+		 * @brief Sends a broadcast STROBE_AT and flushes the framer.
+		 *
+		 * The modules show the frame sent so far once their board time
+		 * reaches the given time, so the next frame can be sent while
+		 * this one waits. A frame whose time has passed is shown at once.
+		 *
+		 * @param time the board time to show the frame at (see time_sync())
+		 * @throws vlpp::bus::bus_error if the write fails
+		 */
+		void strobe_at(std::chrono::milliseconds time);
+
+		/**
+		 * @brief Makes a module reset into config mode and flushes the framer.
+		 *
+		 * Modules with a valid configuration don't wait for the config
+		 * console on startup; this is one way to get there. The module
+		 * stays in config mode until it is left on the console. The modules
+		 * ignore this command on the broadcast address, so they have to be
+		 * sent to config mode one by one.
+		 *
+		 * @param module the address of the module
+		 * @throws std::invalid_argument if module is the broadcast address
+		 * @throws vlpp::bus::bus_error if the write fails
+		 */
+		void enter_config_mode(uint8_t module);
+
+	private:
+		void write_time(uint8_t command, std::chrono::milliseconds time);
+
+
+		framer& _framer;
+};
+
+}//namespace bus
+}//namespace vlpp
+
+#endif // BUS_ENCODER_HPP
@@ -0,0 +1,167 @@
+/*
+ *  This file is part of vaporpp.
+ *
+ *  vaporpp is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vaporpp is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vaporpp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "escape.hpp"
+
+#include <cstring>
+
+#include "protocol.hpp"
+
+#if defined(__SSE2__)
+	#include <emmintrin.h>
+	#define VLPP_ESCAPE_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	#include <arm_neon.h>
+	#define VLPP_ESCAPE_NEON
+#endif
+
+// Both marks only differ in the lowest bit, so masking it off
+// lets us find both with a single comparison:
+static_assert((vlpp::bus::START_MARK & 0xFE) == vlpp::bus::ESCAPE_MARK,
+		"the marks must only differ in the lowest bit");
+
+namespace {
+
+/*
+ * Emits the escape sequence for a byte that is one of the marks.
+ */
+inline uint8_t* escape_mark(uint8_t mark, uint8_t* out) {
+	*out++ = vlpp::bus::ESCAPE_MARK;
+	*out++ = uint8_t(mark - vlpp::bus::ESCAPE_MARK); // 0x54 -> 0x00, 0x55 -> 0x01
+	return out;
+}
+
+/*
+ * Returns the index of the first mark in a block of 16 bytes,
+ * or 16 if there is none. The block is copied to out in any case.
+ */
+#if defined(VLPP_ESCAPE_SSE2)
+inline unsigned find_mark_16(const uint8_t* in, uint8_t* out) {
+	const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(out), block);
+	const __m128i masked = _mm_and_si128(block, _mm_set1_epi8(char(0xFE)));
+	const __m128i hits = _mm_cmpeq_epi8(masked, _mm_set1_epi8(char(vlpp::bus::ESCAPE_MARK)));
+	const unsigned mask = unsigned(_mm_movemask_epi8(hits));
+	return mask ? unsigned(__builtin_ctz(mask)) : 16;
+}
+#elif defined(VLPP_ESCAPE_NEON)
+inline unsigned find_mark_16(const uint8_t* in, uint8_t* out) {
+	const uint8x16_t block = vld1q_u8(in);
+	vst1q_u8(out, block);
+	const uint8x16_t hits = vceqq_u8(vandq_u8(block, vdupq_n_u8(0xFE)),
+			vdupq_n_u8(vlpp::bus::ESCAPE_MARK));
+	// narrow every byte to a nibble; there is no movemask on ARM:
+	const uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(hits), 4);
+	const uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(nibbles), 0);
+	return mask ? unsigned(__builtin_ctzll(mask) / 4) : 16;
+}
+#endif
+
+/*
+ * Returns the index of the first mark in a block of 8 bytes,
+ * or 8 if there is none. The block is copied to out in any case.
+ */
+inline unsigned find_mark_8(const uint8_t* in, uint8_t* out) {
+	const uint64_t ones = 0x0101010101010101ull;
+	uint64_t word;
+	std::memcpy(&word, in, sizeof(word));
+	std::memcpy(out, &word, sizeof(word));
+	// zero-bytes in x are marks:
+	const uint64_t x = (word & (0xFE * ones)) ^ (vlpp::bus::ESCAPE_MARK * ones);
+	// the lowest set high-bit belongs to the first zero-byte; bits above
+	// it may be false positives, but we don't look at them:
+	const uint64_t zeros = (x - ones) & ~x & (0x80 * ones);
+	if (!zeros) {
+		return 8;
+	}
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	return unsigned(__builtin_clzll(zeros) / 8);
+#else
+	return unsigned(__builtin_ctzll(zeros) / 8);
+#endif
+}
+
+/*
+ * Escapes one byte at a time; returns the new end of the output.
+ */
+inline uint8_t* escape_slow(const uint8_t* in, size_t length, uint8_t* out) {
+	for (size_t i = 0; i < length; ++i) {
+		if ((in[i] & 0xFE) == vlpp::bus::ESCAPE_MARK) {
+			out = escape_mark(in[i], out);
+		}
+		else {
+			*out++ = in[i];
+		}
+	}
+	return out;
+}
+
+/*
+ * Like escape_slow, but without branches, for blocks that are known to
+ * contain marks. It always stores two bytes, so it needs one byte of slack.
+ */
+inline uint8_t* escape_block(const uint8_t* in, size_t length, uint8_t* out) {
+	for (size_t i = 0; i < length; ++i) {
+		const uint8_t byte = in[i];
+		const bool mark = (byte & 0xFE) == vlpp::bus::ESCAPE_MARK;
+		out[0] = mark ? uint8_t(vlpp::bus::ESCAPE_MARK) : byte;
+		out[1] = uint8_t(byte - vlpp::bus::ESCAPE_MARK);
+		out += 1 + mark;
+	}
+	return out;
+}
+
+} //anonymous namespace
+
+size_t vlpp::bus::escape_bytewise(const uint8_t* in, size_t length, uint8_t* out) {
+	return size_t(escape_slow(in, length, out) - out);
+}
+
+size_t vlpp::bus::escape(const uint8_t* in, size_t length, uint8_t* out) {
+	uint8_t* const start = out;
+	const uint8_t* const end = in + length;
+
+	// Blocks without marks are copied as a whole. Otherwise, the block
+	// was still copied, so we keep everything up to the first mark and
+	// escape the rest of the block bytewise.
+	// (The branchless escape_block overwrites the last byte in the
+	// output, and every block store is followed by another store or the
+	// end.) The output is always at least as far as the input, so the
+	// slack in max_escaped_size is enough.
+#if defined(VLPP_ESCAPE_SSE2) || defined(VLPP_ESCAPE_NEON)
+	while (end - in >= 16) {
+		const unsigned run = find_mark_16(in, out);
+		out += run;
+		in += run;
+		if (run < 16) {
+			out = escape_block(in, 16 - run, out);
+			in += 16 - run;
+		}
+	}
+#endif
+	while (end - in >= 8) {
+		const unsigned run = find_mark_8(in, out);
+		out += run;
+		in += run;
+		if (run < 8) {
+			out = escape_block(in, 8 - run, out);
+			in += 8 - run;
+		}
+	}
+	return size_t(escape_slow(in, size_t(end - in), out) - start);
+}
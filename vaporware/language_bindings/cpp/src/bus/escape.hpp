@@ -0,0 +1,63 @@
+/*
+ *  This file is part of vaporpp.
+ *
+ *  vaporpp is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vaporpp is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vaporpp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef BUS_ESCAPE_HPP
+#define BUS_ESCAPE_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace vlpp {
+namespace bus {
+
+/**
+ * @brief Escapes a frame-payload for the bus.
+ *
+ * ESCAPE_MARK is replaced by ESCAPE_MARK 0x00 and START_MARK by
+ * ESCAPE_MARK 0x01; all other bytes are copied. Runs without marks are
+ * found with SSE2 or NEON where available and with 64-bit SWAR otherwise,
+ * and copied in bulk.
+ *
+ * @param in the payload
+ * @param length the length of the payload
+ * @param out the output; it must have room for max_escaped_size(length) bytes
+ * @return the number of bytes written to out
+ */
+size_t escape(const uint8_t* in, size_t length, uint8_t* out);
+
+/**
+ * @brief Same as escape(), but looks at one byte at a time.
+ *
+ * This is the reference the vectorized version is checked against.
+ */
+size_t escape_bytewise(const uint8_t* in, size_t length, uint8_t* out);
+
+/**
+ * @brief Returns the size of the output buffer escape() needs.
+ *
+ * This includes some slack, since the vectorized version may
+ * store whole blocks past the end of the escaped data.
+ */
+inline size_t max_escaped_size(size_t length) {
+	return 2 * length + 16;
+}
+
+}//namespace bus
+}//namespace vlpp
+
+#endif // BUS_ESCAPE_HPP
@@ -0,0 +1,171 @@
+/*
+ *  This file is part of vaporpp.
+ *
+ *  vaporpp is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vaporpp is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vaporpp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "frame_builder.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+vlpp::bus::frame_builder::frame_builder(const channel_map& map, encoder& enc):
+	frame_builder(map, std::vector<encoder*>{&enc}) {
+}
+
+vlpp::bus::frame_builder::frame_builder(const channel_map& map, const std::vector<encoder*>& buses):
+	_map(map), _buses(buses) {
+	if (_buses.size() < map.bus_count()) {
+		throw std::invalid_argument("not enough buses for the channel map");
+	}
+	_index.fill(-1);
+	for (auto& module: map.modules()) {
+		_index[module.first] = int(_modules.size());
+		module_state state;
+		state.address = module.first;
+		state.dirty = false;
+		state.changed = 0;
+		state.bus = _buses[module.second.bus];
+		state.values.fill(0);
+		_modules.push_back(state);
+	}
+	invalidate();
+}
+
+void vlpp::bus::frame_builder::set(uint16_t led, uint16_t red, uint16_t green, uint16_t blue) {
+	auto channels = _map.find(led);
+	if (!channels) {
+		return;
+	}
+	set_channel((*channels)[0], red);
+	set_channel((*channels)[1], green);
+	set_channel((*channels)[2], blue);
+}
+
+void vlpp::bus::frame_builder::set_channel(const channel_address& channel, uint16_t value) {
+	if (!channel.used) {
+		return;
+	}
+	// the channel map guarantees that the module exists:
+	const size_t i = size_t(_index[channel.module]);
+	auto& module = _modules[i];
+	if (module.values[channel.position] == value) {
+		return;
+	}
+	module.values[channel.position] = value;
+	module.changed = uint16_t(module.changed | (1u << channel.position));
+	if (!module.dirty) {
+		module.dirty = true;
+		_dirty.push_back(i);
+	}
+}
+
+void vlpp::bus::frame_builder::invalidate() {
+	_dirty.clear();
+	for (size_t i = 0; i < _modules.size(); ++i) {
+		_modules[i].dirty = true;
+		_modules[i].changed = 0xffff;
+		_dirty.push_back(i);
+	}
+}
+
+size_t vlpp::bus::frame_builder::strobe() {
+	return strobe(std::chrono::milliseconds::zero());
+}
+
+size_t vlpp::bus::frame_builder::strobe(std::chrono::milliseconds duration) {
+	if (duration.count() < 0 || duration.count() > 0xffff) {
+		throw std::invalid_argument("fade duration out of range");
+	}
+	if (_dirty.empty()) {
+		return 0;
+	}
+	if (duration == std::chrono::milliseconds::zero()) {
+		for (auto bus: _buses) {
+			if (!send_bulk(bus)) {
+				send_changed(bus);
+			}
+		}
+	}
+	else {
+		// the firmware expects all MODULE_LENGTH channels in a fade, even
+		// if fewer of them are connected:
+		for (auto i: _dirty) {
+			auto& module = _modules[i];
+			module.bus->fade(module.address, module.values.data(), module.values.size(), duration);
+		}
+	}
+	for (auto i: _dirty) {
+		_modules[i].dirty = false;
+		_modules[i].changed = 0;
+	}
+	const size_t returnval = _dirty.size();
+	_dirty.clear();
+	for (auto bus: _buses) {
+		bus->strobe();
+	}
+	return returnval;
+}
+
+void vlpp::bus::frame_builder::send_changed(encoder* bus) {
+	for (auto i: _dirty) {
+		const auto& module = _modules[i];
+		if (module.bus == bus) {
+			bus->update_changed(module.address, module.values.data(), module.changed);
+		}
+	}
+}
+
+bool vlpp::bus::frame_builder::send_bulk(encoder* bus) {
+	// _modules is sorted by address, so we look for the range of
+	// indices of the dirty modules on this bus:
+	size_t first = _modules.size();
+	size_t last = 0;
+	size_t separate_size = 0;
+	for (auto i: _dirty) {
+		const auto& module = _modules[i];
+		if (module.bus != bus) {
+			continue;
+		}
+		first = std::min(first, i);
+		last = std::max(last, i);
+		// one start mark per frame:
+		separate_size += 1 + encoder::update_changed_size(module.changed);
+	}
+	if (first > last || first == last) {
+		return false;
+	}
+	// a bulk frame can only skip modules if they are on the bus
+	// and we know their values, so all addresses in between must be ours:
+	const size_t count = last - first + 1;
+	if (size_t(_modules[last].address - _modules[first].address) + 1 != count) {
+		return false;
+	}
+	for (size_t i = first; i <= last; ++i) {
+		if (_modules[i].bus != bus) {
+			return false;
+		}
+	}
+	if (1 + encoder::update_bulk_size(count) >= separate_size) {
+		return false;
+	}
+	std::vector<uint16_t> values;
+	values.reserve(count * MODULE_LENGTH);
+	for (size_t i = first; i <= last; ++i) {
+		values.insert(values.end(), _modules[i].values.begin(), _modules[i].values.end());
+	}
+	bus->update_bulk(_modules[first].address, values.data(), count);
+	return true;
+}
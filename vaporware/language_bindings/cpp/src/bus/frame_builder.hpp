@@ -0,0 +1,133 @@
+/*
+ *  This file is part of vaporpp.
+ *
+ *  vaporpp is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vaporpp is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vaporpp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef BUS_FRAME_BUILDER_HPP
+#define BUS_FRAME_BUILDER_HPP
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "channel_map.hpp"
+#include "encoder.hpp"
+#include "protocol.hpp"
+
+namespace vlpp {
+namespace bus {
+
+/**
+ * @brief Builds bus frames that only contain the modules that changed.
+ *
+ * The state of every module is cached here. Unlike Buffer.scala, only
+ * modules whose channels changed since the last strobe are sent; a frame
+ * is one command per changed module followed by one broadcast STROBE.
+ * Each module is sent as SET_SPARSE with the changed channels or as
+ * SET_RAW with all of them, whichever is shorter. If it is shorter
+ * still, a range of modules with consecutive addresses is sent in one
+ * BULK_RAW command instead; unchanged modules in the range are sent
+ * again with their current values.
+ */
+class frame_builder {
+	public:
+		/**
+		 * @brief Creates a frame builder for all modules of a channel map.
+		 *
+		 * All modules are sent with the first strobe, since the state
+		 * of the boards is unknown until then.
+		 *
+		 * @param map the channel map; it must outlive the frame builder
+		 * @param enc the encoder the bus-commands will be sent to
+		 */
+		frame_builder(const channel_map& map, encoder& enc);
+
+		/**
+		 * @brief Creates a frame builder for modules spread over several buses.
+		 *
+		 * Every frame is sent to all buses, if only as a bare STROBE, so
+		 * that all of them latch at once (see multi_bus).
+		 *
+		 * @param map the channel map; it must outlive the frame builder
+		 * @param buses one encoder per bus of the channel map; they must outlive the frame builder
+		 * @throws std::invalid_argument if there are fewer encoders than buses
+		 */
+		frame_builder(const channel_map& map, const std::vector<encoder*>& buses);
+
+		/**
+		 * @brief Updates a LED. Won't take effect until strobe() is called.
+		 */
+		void set(uint16_t led, uint16_t red, uint16_t green, uint16_t blue);
+
+		/**
+		 * @brief Makes the next strobe() send all modules.
+		 */
+		void invalidate();
+
+		/**
+		 * @brief Sends the changed modules and makes them take effect.
+		 *
+		 * Nothing is sent if no module changed.
+		 *
+		 * @return the number of modules sent
+		 * @throws vlpp::bus::bus_error if the bus write fails
+		 */
+		size_t strobe();
+
+		/**
+		 * @brief Like strobe(), but the changed modules fade to their new values.
+		 *
+		 * The modules compute the steps of the fade themselves, so the
+		 * whole fade costs one frame on the bus. Modules that don't
+		 * change in the next frames keep fading; changing one of them
+		 * ends its fade.
+		 *
+		 * @param duration the duration of the fade, at most 65535ms
+		 * @return the number of modules sent
+		 * @throws vlpp::bus::bus_error if the bus write fails
+		 * @throws std::invalid_argument if the duration is out of range
+		 */
+		size_t strobe(std::chrono::milliseconds duration);
+
+	private:
+		struct module_state {
+			uint8_t address;
+			bool dirty;
+			// the channels that changed, bit i for channel i:
+			uint16_t changed;
+			encoder* bus;
+			std::array<uint16_t, MODULE_LENGTH> values;
+		};
+
+		void set_channel(const channel_address& channel, uint16_t value);
+		void send_changed(encoder* bus);
+		bool send_bulk(encoder* bus);
+
+		const channel_map& _map;
+		std::vector<encoder*> _buses;
+		std::vector<module_state> _modules;
+		// maps module-addresses to indices in _modules, -1 if unknown:
+		std::array<int, 256> _index;
+		// the indices of the dirty modules, in the order they changed:
+		std::vector<size_t> _dirty;
+};
+
+}//namespace bus
+}//namespace vlpp
+
+#endif // BUS_FRAME_BUILDER_HPP
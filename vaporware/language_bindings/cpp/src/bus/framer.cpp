@@ -0,0 +1,46 @@
+/*
+ *  This file is part of vaporpp.
+ *
+ *  vaporpp is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vaporpp is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vaporpp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "framer.hpp"
+
+#include <algorithm>
+
+#include "escape.hpp"
+#include "protocol.hpp"
+
+vlpp::bus::framer::framer(device& dev, size_t capacity):
+	_device(dev), _buffer(capacity) {
+}
+
+void vlpp::bus::framer::write(const uint8_t* payload, size_t length) {
+	const size_t needed = _size + 1 + max_escaped_size(length);
+	if (needed > _buffer.size()) {
+		_buffer.resize(std::max(needed, 2 * _buffer.size()));
+	}
+	_buffer[_size++] = START_MARK;
+	const size_t escaped = escape(payload, length, &_buffer[_size]);
+	_size += escaped;
+}
+
+void vlpp::bus::framer::flush() {
+	if (_size == 0) {
+		return;
+	}
+	_device.write(_buffer.data(), _size);
+	_size = 0;
+}
@@ -0,0 +1,72 @@
+/*
+ *  This file is part of vaporpp.
+ *
+ *  vaporpp is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vaporpp is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vaporpp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef BUS_FRAMER_HPP
+#define BUS_FRAMER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "device.hpp"
+
+namespace vlpp {
+namespace bus {
+
+/**
+ * @brief Frames byte sequences for the bus.
+ *
+ * Every frame starts with START_MARK; inside the payload, ESCAPE_MARK is
+ * replaced by ESCAPE_MARK 0x00 and START_MARK by ESCAPE_MARK 0x01.
+ *
+ * Frames are escaped into a preallocated buffer and only written to the
+ * device, in a single write, when flush() is called.
+ */
+class framer {
+	public:
+		/**
+		 * @brief Creates a framer that writes to the given device.
+		 * @param dev the device; it must outlive the framer
+		 * @param capacity the initial size of the buffer in bytes; it grows if needed
+		 */
+		explicit framer(device& dev, size_t capacity = 4096);
+
+		/**
+		 * @brief Appends one frame to the internal buffer.
+		 * @param payload the unescaped frame-payload (address, command, arguments)
+		 * @param length the length of the payload
+		 */
+		void write(const uint8_t* payload, size_t length);
+
+		/**
+		 * @brief Writes all buffered frames to the device.
+		 * @throws vlpp::bus::bus_error if the write fails
+		 */
+		void flush();
+
+	private:
+		device& _device;
+		std::vector<uint8_t> _buffer;
+		// the number of bytes of _buffer in use:
+		size_t _size = 0;
+};
+
+}//namespace bus
+}//namespace vlpp
+
+#endif // BUS_FRAMER_HPP
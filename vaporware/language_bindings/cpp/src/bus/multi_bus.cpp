@@ -0,0 +1,290 @@
+/*
+ *  This file is part of vaporpp.
+ *
+ *  vaporpp is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vaporpp is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vaporpp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "multi_bus.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "protocol.hpp"
+#include "spsc_queue.hpp"
+
+namespace {
+
+using vlpp::bus::bus_clock;
+
+enum {
+	// frames are only written when the bus is ready, so two would do:
+	QUEUE_LENGTH = 4,
+	// a broadcast STROBE on the wire:
+	STROBE_LENGTH = 3
+};
+
+// how often to look at a bus that has no estimate when it will be ready:
+const auto POLL_INTERVAL = std::chrono::milliseconds(1);
+
+// the value of lane::_ready_at while the thread is writing a frame:
+const bus_clock::rep BUSY = std::numeric_limits<bus_clock::rep>::max();
+
+bool ends_with_strobe(const std::vector<uint8_t>& frame) {
+	using namespace vlpp::bus;
+	const uint8_t strobe[STROBE_LENGTH] = { START_MARK, BROADCAST_ADDRESS, CMD_STROBE };
+	// START_MARK never occurs in an escaped payload, so this can't be a false positive:
+	return frame.size() >= STROBE_LENGTH &&
+		std::equal(strobe, strobe + STROBE_LENGTH, frame.end() - STROBE_LENGTH);
+}
+
+} //anonymous namespace
+
+/*
+ * Makes the writer threads wait for each other before they strobe.
+ */
+class vlpp::bus::multi_bus::latch {
+	public:
+		explicit latch(size_t count): _count(count) {}
+
+		/*
+		 * Waits until all threads arrived with their frame and sets strobe_at
+		 * to the time the slowest bus will be idle. Returns false if the
+		 * latch was stopped; error() tells whether a bus failed.
+		 */
+		bool arrive(bus_clock::time_point idle_at, bus_clock::time_point& strobe_at) {
+			std::unique_lock<std::mutex> lock(_mutex);
+			if (_stopped) {
+				return false;
+			}
+			_latest = std::max(_latest, idle_at);
+			const uint64_t generation = _generation;
+			if (++_waiting == _count) {
+				// the others can't arrive again before we leave, so _strobe_at is safe:
+				_strobe_at = _latest;
+				_latest = bus_clock::time_point::min();
+				_waiting = 0;
+				++_generation;
+				_released.notify_all();
+			}
+			else {
+				_released.wait(lock, [&]{ return _stopped || _generation != generation; });
+			}
+			strobe_at = _strobe_at;
+			return !_stopped;
+		}
+
+		/*
+		 * Releases all threads for good, because the buses are shut down or,
+		 * if error is set, because one of them failed.
+		 */
+		void stop(std::exception_ptr error = nullptr) {
+			std::lock_guard<std::mutex> lock(_mutex);
+			if (!_stopped) {
+				_error = error;
+			}
+			_stopped = true;
+			_released.notify_all();
+		}
+
+		std::exception_ptr error() {
+			std::lock_guard<std::mutex> lock(_mutex);
+			return _error;
+		}
+
+	private:
+		std::mutex _mutex;
+		std::condition_variable _released;
+		const size_t _count;
+		size_t _waiting = 0;
+		uint64_t _generation = 0;
+		bus_clock::time_point _latest = bus_clock::time_point::min();
+		bus_clock::time_point _strobe_at;
+		bool _stopped = false;
+		std::exception_ptr _error;
+};
+
+/*
+ * The device that feeds one bus, and its writer thread.
+ */
+class vlpp::bus::multi_bus::lane : public vlpp::bus::device {
+	public:
+		lane(std::unique_ptr<device> dev, latch& l):
+			_device(std::move(dev)), _latch(l),
+			_ready_at(bus_clock::now().time_since_epoch().count()) {
+			_thread = std::thread([this]{ run(); });
+		}
+
+		~lane() {
+			stop();
+			_thread.join();
+		}
+
+		void write(const uint8_t* data, size_t length) override {
+			rethrow_error();
+			std::vector<uint8_t> buffer;
+			// reuse the buffers the thread is done with:
+			_recycled.pop(buffer);
+			buffer.assign(data, data + length);
+			++_stats.frames;
+			_stats.bytes += length;
+			while (!_frames.push(std::move(buffer))) {
+				rethrow_error();
+				std::this_thread::yield();
+			}
+			// the lock makes sure the thread is either waiting or sees the frame:
+			{ std::lock_guard<std::mutex> lock(_mutex); }
+			_wakeup.notify_one();
+		}
+
+		bus_clock::time_point ready_at() const override {
+			rethrow_error();
+			const auto ready_at = _ready_at.load();
+			if (ready_at == BUSY || !_frames.empty()) {
+				return bus_clock::now() + POLL_INTERVAL;
+			}
+			return bus_clock::time_point(bus_clock::duration(ready_at));
+		}
+
+		void drain() override {
+			rethrow_error();
+		}
+
+		size_t pending() const override {
+			rethrow_error();
+			return _pending.load();
+		}
+
+		statistics stats() const override {
+			statistics returnval = _stats;
+			returnval.busy = bus_clock::duration(_busy.load());
+			return returnval;
+		}
+
+		void stop() {
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stopped = true;
+			_wakeup.notify_one();
+		}
+
+	private:
+		bool next(std::vector<uint8_t>& frame) {
+			std::unique_lock<std::mutex> lock(_mutex);
+			// keep handing what the kernel didn't take yet to the device:
+			while (!_stopped && _frames.empty() && _device->pending() != 0) {
+				_wakeup.wait_for(lock, POLL_INTERVAL);
+				_device->drain();
+				publish();
+			}
+			_wakeup.wait(lock, [&]{ return _stopped || !_frames.empty(); });
+			return !_stopped && _frames.pop(frame);
+		}
+
+		void publish() {
+			_busy = _device->stats().busy.count();
+			_pending = _device->pending();
+			_ready_at = _device->ready_at().time_since_epoch().count();
+		}
+
+		void run() {
+			try {
+				std::vector<uint8_t> frame;
+				while (next(frame)) {
+					_ready_at = BUSY;
+					const bool strobe = ends_with_strobe(frame);
+					const size_t length = frame.size() - (strobe ? STROBE_LENGTH : 0);
+					_device->write(frame.data(), length);
+					if (strobe) {
+						bus_clock::time_point strobe_at;
+						if (!_latch.arrive(_device->idle_at(), strobe_at)) {
+							// without the other buses, we can't strobe anymore:
+							if (_latch.error()) {
+								fail(_latch.error());
+							}
+							return;
+						}
+						// keep the line busy with whatever the kernel didn't take yet:
+						_device->drain();
+						while (bus_clock::now() < strobe_at) {
+							std::this_thread::sleep_until(std::min(strobe_at, bus_clock::now() + POLL_INTERVAL));
+							_device->drain();
+						}
+						_device->write(frame.data() + length, STROBE_LENGTH);
+					}
+					publish();
+					frame.clear();
+					_recycled.push(std::move(frame));
+				}
+			} catch (...) {
+				fail(std::current_exception());
+				// the other threads would wait for us forever:
+				_latch.stop(std::current_exception());
+			}
+		}
+
+		void fail(std::exception_ptr error) {
+			std::lock_guard<std::mutex> lock(_mutex);
+			_error = error;
+			_failed = true;
+		}
+
+		void rethrow_error() const {
+			if (_failed) {
+				std::lock_guard<std::mutex> lock(_mutex);
+				std::rethrow_exception(_error);
+			}
+		}
+
+		std::unique_ptr<device> _device;
+		latch& _latch;
+		spsc_queue<std::vector<uint8_t>, QUEUE_LENGTH> _frames;
+		spsc_queue<std::vector<uint8_t>, QUEUE_LENGTH> _recycled;
+
+		// only used to wait for frames and to report errors:
+		mutable std::mutex _mutex;
+		std::condition_variable _wakeup;
+		bool _stopped = false;
+		std::exception_ptr _error;
+		std::atomic<bool> _failed{false};
+
+		// published by the thread:
+		std::atomic<bus_clock::rep> _ready_at;
+		std::atomic<bus_clock::rep> _busy{0};
+		std::atomic<size_t> _pending{0};
+
+		std::thread _thread;
+};
+
+vlpp::bus::multi_bus::multi_bus(std::vector<std::unique_ptr<device>> devices):
+	_latch(new latch(devices.size())) {
+	for (auto& dev: devices) {
+		_lanes.emplace_back(new lane(std::move(dev), *_latch));
+	}
+}
+
+vlpp::bus::multi_bus::~multi_bus() {
+	_latch->stop();
+	_lanes.clear();
+}
+
+vlpp::bus::device& vlpp::bus::multi_bus::operator[](size_t bus) {
+	return *_lanes.at(bus);
+}
@@ -0,0 +1,82 @@
+/*
+ *  This file is part of vaporpp.
+ *
+ *  vaporpp is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vaporpp is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vaporpp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef BUS_MULTI_BUS_HPP
+#define BUS_MULTI_BUS_HPP
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "device.hpp"
+
+namespace vlpp {
+namespace bus {
+
+/**
+ * @brief Drives several buses in parallel, one writer thread per bus.
+ *
+ * Every bus is represented by a device that hands the frames written to
+ * it to the writer thread of the bus through a lock-free queue. Frames
+ * that end with a broadcast STROBE are latched on all buses at once: each
+ * thread writes the updates of its frame, then all of them wait until the
+ * slowest bus is done and write their STROBE at the same time. Hence every
+ * frame must be sent to every bus, if only as a bare STROBE (which is what
+ * frame_builder does). If one bus fails, the others can't strobe anymore,
+ * so all of them fail with its bus_error.
+ */
+class multi_bus {
+	public:
+		/**
+		 * @brief Starts a writer thread for every device.
+		 * @param devices the devices of the buses
+		 */
+		explicit multi_bus(std::vector<std::unique_ptr<device>> devices);
+
+		/**
+		 * @brief Stops the writer threads; frames that were not written yet are lost.
+		 */
+		~multi_bus();
+
+		/**
+		 * @brief Returns the number of buses.
+		 */
+		size_t size() const { return _lanes.size(); }
+
+		/**
+		 * @brief Returns the device that feeds a bus.
+		 *
+		 * The devices may only be used by a single thread. Once a writer thread
+		 * failed, write(), drain(), ready_at() and pending() of its device
+		 * throw its bus_error.
+		 */
+		device& operator[](size_t bus);
+
+	private:
+		class latch;
+		class lane;
+
+		// declared first, since the lanes use it until they are destroyed:
+		std::unique_ptr<latch> _latch;
+		std::vector<std::unique_ptr<lane>> _lanes;
+};
+
+}//namespace bus
+}//namespace vlpp
+
+#endif // BUS_MULTI_BUS_HPP
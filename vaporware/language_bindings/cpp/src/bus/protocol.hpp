@@ -0,0 +1,70 @@
+/*
+ *  This file is part of vaporpp.
+ *
+ *  vaporpp is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vaporpp is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vaporpp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef BUS_PROTOCOL_HPP
+#define BUS_PROTOCOL_HPP
+
+#include <cstdint>
+
+namespace vlpp {
+namespace bus {
+
+/*
+ * Constants of the RS485 bus protocol spoken by the LED boards
+ * (see HACKING and led-boards/command.c).
+ */
+
+// framing:
+enum: uint8_t {
+	START_MARK = 0x55,
+	ESCAPE_MARK = 0x54
+};
+
+// commands:
+enum: uint8_t {
+	CMD_SET_RAW = 0x00,
+	CMD_SET_XYY = 0x01,
+	CMD_FADE_RAW = 0x02,
+	CMD_SET_SPARSE = 0x03,
+	CMD_SET_RAW8 = 0x04,
+	CMD_BULK_RAW = 0x05,
+	CMD_TIME_SYNC = 0x06,
+	CMD_STROBE_AT = 0x07,
+	CMD_CONFIG_MODE = 0x08,
+	CMD_STROBE = 0xFF
+};
+
+// addresses:
+enum: uint8_t {
+	BROADCAST_ADDRESS = 0xFF
+};
+
+// the key of CMD_CONFIG_MODE:
+enum: uint32_t {
+	CONFIG_MODE_KEY = 0xC0F1C0DE
+};
+
+/**
+ * @brief number of PWM channels on one LED board
+ */
+enum { MODULE_LENGTH = 16 };
+
+}//namespace bus
+}//namespace vlpp
+
+#endif // BUS_PROTOCOL_HPP
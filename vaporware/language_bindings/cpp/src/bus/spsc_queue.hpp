@@ -0,0 +1,89 @@
+/*
+ *  This file is part of vaporpp.
+ *
+ *  vaporpp is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vaporpp is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vaporpp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef BUS_SPSC_QUEUE_HPP
+#define BUS_SPSC_QUEUE_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+namespace vlpp {
+namespace bus {
+
+/**
+ * @brief A lock-free queue for exactly one producer and one consumer thread.
+ *
+ * @tparam T the type of the elements; it should be cheap to move
+ * @tparam Size the capacity; must be a power of two
+ */
+template<typename T, size_t Size>
+class spsc_queue {
+		static_assert(Size >= 2 && (Size & (Size - 1)) == 0, "the size must be a power of two");
+
+	public:
+		/**
+		 * @brief Appends an element; may only be called by the producer.
+		 * @return false if the queue is full, in which case value is untouched
+		 */
+		bool push(T&& value) {
+			const size_t head = _head.load(std::memory_order_relaxed);
+			if (head - _tail.load(std::memory_order_acquire) == Size) {
+				return false;
+			}
+			_slots[head & (Size - 1)] = std::move(value);
+			_head.store(head + 1, std::memory_order_release);
+			return true;
+		}
+
+		/**
+		 * @brief Removes the oldest element; may only be called by the consumer.
+		 * @return false if the queue is empty
+		 */
+		bool pop(T& value) {
+			const size_t tail = _tail.load(std::memory_order_relaxed);
+			if (_head.load(std::memory_order_acquire) == tail) {
+				return false;
+			}
+			value = std::move(_slots[tail & (Size - 1)]);
+			_tail.store(tail + 1, std::memory_order_release);
+			return true;
+		}
+
+		/**
+		 * @brief Returns whether the queue is empty; may be called by either thread.
+		 */
+		bool empty() const {
+			return _head.load(std::memory_order_acquire) == _tail.load(std::memory_order_acquire);
+		}
+
+	private:
+		// Padded to separate cache-lines, so that the threads don't fight
+		// over them (alignas would need C++17 for heap-allocated queues):
+		std::atomic<size_t> _head{0};
+		char _head_padding[64 - sizeof(std::atomic<size_t>)];
+		std::atomic<size_t> _tail{0};
+		char _tail_padding[64 - sizeof(std::atomic<size_t>)];
+		std::array<T, Size> _slots;
+};
+
+}//namespace bus
+}//namespace vlpp
+
+#endif // BUS_SPSC_QUEUE_HPP
@@ -0,0 +1,59 @@
+/*
+ *  This file is part of vaporpp.
+ *
+ *  vaporpp is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vaporpp is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vaporpp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef COLOR_HPP
+#define COLOR_HPP
+
+#include <cstdint>
+
+/**
+ * @brief A 16-bit rgba-color, as used inside the daemon.
+ *
+ * An alpha of 0 is transparent, 0xffff is opaque.
+ */
+struct color {
+	uint16_t r = 0;
+	uint16_t g = 0;
+	uint16_t b = 0;
+	uint16_t a = 0;
+
+	color() = default;
+	color(uint16_t R, uint16_t G, uint16_t B, uint16_t A): r(R), g(G), b(B), a(A) {}
+
+	/**
+	 * @brief Creates a color from 8-bit values, expanding 0xab to 0xabab.
+	 */
+	static color from_8bit(uint8_t R, uint8_t G, uint8_t B, uint8_t A) {
+		return {uint16_t(R * 0x101), uint16_t(G * 0x101), uint16_t(B * 0x101), uint16_t(A * 0x101)};
+	}
+
+	/**
+	 * @brief Blends this color over a background; the result is opaque.
+	 */
+	color blend_over(const color& bg) const {
+		return {blend(r, bg.r), blend(g, bg.g), blend(b, bg.b), UINT16_MAX};
+	}
+
+	private:
+		uint16_t blend(uint16_t fg, uint16_t bg) const {
+			// cannot overflow: fg*a + bg*(max-a) <= max*max
+			return uint16_t(((uint32_t)fg * a + (uint32_t)bg * (UINT16_MAX - a)) / UINT16_MAX);
+		}
+};
+
+#endif // COLOR_HPP
@@ -0,0 +1,199 @@
+/*
+ *  This file is part of vaporpp.
+ *
+ *  vaporpp is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vaporpp is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vaporpp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/program_options.hpp>
+
+#include "../bus/encoder.hpp"
+#include "../bus/frame_builder.hpp"
+#include "../bus/framer.hpp"
+#include "../bus/multi_bus.hpp"
+
+#include "mixer.hpp"
+#include "server.hpp"
+#include "settings.hpp"
+
+
+namespace {
+
+// how often to look at a bus that didn't take all of the last frame yet:
+const auto BACKLOG_POLL_INTERVAL = std::chrono::milliseconds(1);
+
+} //anonymous namespace
+
+/*
+ * A native implementation of the vaporlight daemon: it accepts the
+ * low-level protocol, composites the layers of all tokens and writes
+ * the result to the bus.
+ */
+int main(int argc, char**argv) {
+	using std::string;
+	namespace bpo = boost::program_options;
+
+	string config_path;
+	unsigned stats_interval;
+
+	try {
+		bpo::options_description desc;
+		desc.add_options()
+			("help,h", "print this help")
+			("config,c", bpo::value<string>(&config_path)->default_value("vapord.json"),
+				"sets the configuration-file")
+			("stats,s", bpo::value<unsigned>(&stats_interval)->default_value(0),
+				"prints the bus-statistics every n seconds (0 to disable)");
+
+		bpo::variables_map vm;
+		bpo::store(bpo::parse_command_line(argc, argv, desc), vm);
+		bpo::notify(vm);
+
+		if (vm.count("help")) {
+			std::cout << desc << std::endl;
+			return 0;
+		}
+
+		auto conf = settings::load(config_path);
+		// a single bus is written directly, several ones by a thread each:
+		std::vector<std::unique_ptr<vlpp::bus::device>> devices;
+		for (auto& bus: conf.buses) {
+			devices.push_back(bus.open());
+		}
+		std::unique_ptr<vlpp::bus::multi_bus> threads;
+		std::vector<vlpp::bus::device*> buses;
+		if (devices.size() == 1) {
+			buses.push_back(devices.front().get());
+		}
+		else {
+			threads.reset(new vlpp::bus::multi_bus(std::move(devices)));
+			for (size_t i = 0; i < threads->size(); ++i) {
+				buses.push_back(&(*threads)[i]);
+			}
+		}
+		std::vector<std::unique_ptr<vlpp::bus::framer>> framers;
+		std::vector<std::unique_ptr<vlpp::bus::encoder>> encoders;
+		std::vector<vlpp::bus::encoder*> bus_encoders;
+		for (auto bus: buses) {
+			framers.emplace_back(new vlpp::bus::framer(*bus));
+			encoders.emplace_back(new vlpp::bus::encoder(*framers.back()));
+			bus_encoders.push_back(encoders.back().get());
+		}
+		vlpp::bus::frame_builder frames(conf.channels, bus_encoders);
+		mixer mix(frames);
+
+		// frames go to all buses, so we have to wait for the slowest one:
+		auto ready_at = [&buses]{
+			auto returnval = vlpp::bus::bus_clock::time_point::min();
+			for (auto bus: buses) {
+				returnval = std::max(returnval, bus->ready_at());
+			}
+			return returnval;
+		};
+
+		// whether a bus still holds bytes of an earlier frame:
+		auto backed_up = [&buses]{
+			for (auto bus: buses) {
+				if (bus->pending() != 0) {
+					return true;
+				}
+			}
+			return false;
+		};
+
+		boost::asio::io_service io;
+		// Render once the buses can take the next frame. Until then, all
+		// strobes are merged in the mixer, so a slow bus drops intermediate
+		// frames instead of showing them late. A bus whose kernel buffer is
+		// full is not ready either, however early it expected to be, since
+		// the new frame would only queue up behind the old one. Devices that
+		// don't know their speed are always ready, which still renders at
+		// most once per turn of the event-loop.
+		boost::asio::steady_timer render_timer(io);
+		std::function<void()> schedule_render = [&]{
+			auto render_at = ready_at();
+			if (backed_up()) {
+				render_at = std::max(render_at, vlpp::bus::bus_clock::now() + BACKLOG_POLL_INTERVAL);
+			}
+			render_timer.expires_at(render_at);
+			render_timer.async_wait([&](const boost::system::error_code& e){
+				if (e) {
+					return;
+				}
+				for (auto bus: buses) {
+					bus->drain();
+				}
+				if (backed_up() || ready_at() > vlpp::bus::bus_clock::now()) {
+					schedule_render();
+					return;
+				}
+				mix.render();
+			});
+		};
+		mix.on_dirty(schedule_render);
+
+		boost::asio::steady_timer stats_timer(io);
+		std::vector<vlpp::bus::statistics> last_stats(buses.size());
+		std::function<void()> print_stats = [&]{
+			stats_timer.expires_from_now(std::chrono::seconds(stats_interval));
+			stats_timer.async_wait([&](const boost::system::error_code& e){
+				if (e) {
+					return;
+				}
+				const double seconds = stats_interval;
+				for (size_t i = 0; i < buses.size(); ++i) {
+					const auto stats = buses[i]->stats();
+					const auto& last = last_stats[i];
+					const std::chrono::duration<double> busy = stats.busy - last.busy;
+					std::cout << "bus " << i << ": " << (stats.frames - last.frames) / seconds << " fps, "
+					          << (stats.bytes - last.bytes) / seconds << " bytes/s, "
+					          << 100 * busy.count() / seconds << "% utilization" << std::endl;
+					last_stats[i] = stats;
+				}
+				print_stats();
+			});
+		};
+		if (stats_interval > 0) {
+			print_stats();
+		}
+
+		server srv(io, conf, mix);
+
+		boost::asio::signal_set signals(io, SIGINT, SIGTERM);
+		signals.async_wait([&io](const boost::system::error_code&, int){
+			io.stop();
+		});
+
+		io.run();
+
+		// the sessions release their overlays when io is destroyed:
+		mix.on_dirty(nullptr);
+		return 0;
+	} catch (std::exception& e) {
+		std::cerr << "Error: " << e.what() << std::endl;
+		return 1;
+	}
+}
@@ -0,0 +1,110 @@
+/*
+ *  This file is part of vaporpp.
+ *
+ *  vaporpp is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vaporpp is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vaporpp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "mixer.hpp"
+
+#include <algorithm>
+#include <climits>
+
+overlay::overlay(int priority, bool persistent):
+	_priority(priority), _persistent(persistent) {
+}
+
+void overlay::set(uint16_t led, const color& col) {
+	_back[led] = col;
+	_back_dirty.insert(led);
+}
+
+///////////
+
+mixer::mixer(vlpp::bus::frame_builder& frames):
+	_frames(frames) {
+	// the background is below everything else and always opaque black:
+	register_overlay(INT_MIN, true);
+}
+
+overlay* mixer::register_overlay(int priority, bool persistent) {
+	std::unique_ptr<overlay> ov(new overlay(priority, persistent));
+	auto pos = std::upper_bound(_overlays.begin(), _overlays.end(), priority,
+		[](int prio, const std::unique_ptr<overlay>& other){
+			return prio < other->priority();
+		});
+	return _overlays.insert(pos, std::move(ov))->get();
+}
+
+void mixer::release(overlay* ov) {
+	if (ov->persistent()) {
+		return;
+	}
+	auto it = std::find_if(_overlays.begin(), _overlays.end(),
+		[ov](const std::unique_ptr<overlay>& other){
+			return other.get() == ov;
+		});
+	if (it == _overlays.end()) {
+		return;
+	}
+	// whatever the overlay covered must be recomposited:
+	for (auto& led: ov->_front) {
+		mark_dirty(led.first);
+	}
+	_overlays.erase(it);
+}
+
+void mixer::strobe(overlay& ov) {
+	for (auto led: ov._back_dirty) {
+		ov._front[led] = ov._back[led];
+		mark_dirty(led);
+	}
+	ov._back_dirty.clear();
+}
+
+void mixer::on_dirty(std::function<void()> callback) {
+	_on_dirty = callback;
+}
+
+void mixer::render() {
+	_render_requested = false;
+	if (_dirty.empty()) {
+		return;
+	}
+	for (auto led: _dirty) {
+		const color col = blended_color(led);
+		_frames.set(led, col.r, col.g, col.b);
+	}
+	_dirty.clear();
+	_frames.strobe();
+}
+
+void mixer::mark_dirty(uint16_t led) {
+	_dirty.insert(led);
+	if (!_render_requested && _on_dirty) {
+		_render_requested = true;
+		_on_dirty();
+	}
+}
+
+color mixer::blended_color(uint16_t led) const {
+	color returnval(0, 0, 0, UINT16_MAX);
+	for (auto& ov: _overlays) {
+		auto it = ov->_front.find(led);
+		if (it != ov->_front.end()) {
+			returnval = it->second.blend_over(returnval);
+		}
+	}
+	return returnval;
+}
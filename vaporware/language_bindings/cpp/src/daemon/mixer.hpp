@@ -0,0 +1,117 @@
+/*
+ *  This file is part of vaporpp.
+ *
+ *  vaporpp is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vaporpp is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vaporpp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef MIXER_HPP
+#define MIXER_HPP
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+#include "../bus/frame_builder.hpp"
+
+#include "color.hpp"
+
+/**
+ * @brief One layer of LED colors, owned by a token.
+ *
+ * Colors are written to a back buffer and only become visible
+ * when the layer is strobed (see mixer::strobe).
+ */
+class overlay {
+	public:
+		overlay(int priority, bool persistent);
+
+		/**
+		 * @brief Sets a LED in the back buffer.
+		 */
+		void set(uint16_t led, const color& col);
+
+		int priority() const { return _priority; }
+		bool persistent() const { return _persistent; }
+
+	private:
+		friend class mixer;
+
+		int _priority;
+		bool _persistent;
+		std::unordered_map<uint16_t, color> _front;
+		std::unordered_map<uint16_t, color> _back;
+		std::set<uint16_t> _back_dirty;
+};
+
+/**
+ * @brief Composites the overlays of all clients onto a single bus.
+ *
+ * Overlays are blended over one another in the order of ascending priority;
+ * overlays with equal priority are blended in order of creation.
+ *
+ * The mixer is not threadsafe; it is meant to be driven by a single io_service.
+ */
+class mixer {
+	public:
+		/**
+		 * @brief Creates a mixer.
+		 * @param frames the frame builder the composited colors will be sent to
+		 */
+		explicit mixer(vlpp::bus::frame_builder& frames);
+
+		/**
+		 * @brief Creates a new overlay.
+		 * @return a pointer to the overlay which stays valid until release() is called
+		 */
+		overlay* register_overlay(int priority, bool persistent);
+
+		/**
+		 * @brief Drops a non-persistent overlay; persistent overlays are kept.
+		 */
+		void release(overlay* ov);
+
+		/**
+		 * @brief Makes the back buffer of an overlay visible.
+		 */
+		void strobe(overlay& ov);
+
+		/**
+		 * @brief Sets the function that is called once there is something to render.
+		 *
+		 * It is called at most once until the next call of render().
+		 */
+		void on_dirty(std::function<void()> callback);
+
+		/**
+		 * @brief Composites all dirty LEDs and sends the changed modules to the bus.
+		 * @throws vlpp::bus::bus_error if the bus write fails
+		 */
+		void render();
+
+	private:
+		void mark_dirty(uint16_t led);
+		color blended_color(uint16_t led) const;
+
+		vlpp::bus::frame_builder& _frames;
+		std::vector<std::unique_ptr<overlay>> _overlays;
+		std::set<uint16_t> _dirty;
+		std::function<void()> _on_dirty;
+		bool _render_requested = false;
+};
+
+#endif // MIXER_HPP
@@ -0,0 +1,178 @@
+/*
+ *  This file is part of vaporpp.
+ *
+ *  vaporpp is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vaporpp is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vaporpp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "server.hpp"
+
+#include <iostream>
+#include <stdexcept>
+
+using boost::asio::ip::tcp;
+
+//opcodes:
+enum:
+uint8_t {
+	OP_SET_LED_8 = 0x01,
+	OP_AUTHENTICATE = 0x02,
+	OP_SET_LED_16 = 0x03,
+	OP_STROBE = 0xFF
+};
+
+enum { TOKEN_SIZE = 16 };
+
+namespace {
+
+/**
+ * Exception to be thrown if a client sends garbage.
+ */
+class protocol_violation : public std::runtime_error {
+	public:
+		protocol_violation(const std::string& msg) : std::runtime_error(msg){}
+};
+
+size_t payload_length(uint8_t opcode) {
+	switch (opcode) {
+		case OP_SET_LED_8: return 6;
+		case OP_AUTHENTICATE: return TOKEN_SIZE;
+		case OP_SET_LED_16: return 10;
+		case OP_STROBE: return 0;
+		default:
+			throw protocol_violation("invalid opcode: " + std::to_string(opcode));
+	}
+}
+
+uint16_t read_uint16(const uint8_t* data) {
+	return uint16_t((data[0] << 8) | data[1]);
+}
+
+} //anonymous namespace
+
+session::session(tcp::socket socket, server& srv):
+	_socket(std::move(socket)), _server(srv), _mixer(srv._mixer) {
+}
+
+session::~session() {
+	if (_overlay) {
+		_mixer.release(_overlay);
+	}
+}
+
+void session::start() {
+	read();
+}
+
+void session::read() {
+	auto self = shared_from_this();
+	_socket.async_read_some(boost::asio::buffer(_read_buffer),
+		[this, self](const boost::system::error_code& e, size_t length){
+			if (e) {
+				return;
+			}
+			try {
+				process(length);
+			} catch (protocol_violation& err) {
+				std::cerr << "closing connection: " << err.what() << std::endl;
+				return;
+			}
+			read();
+		});
+}
+
+void session::process(size_t length) {
+	_pending.insert(_pending.end(), _read_buffer.begin(), _read_buffer.begin() + length);
+
+	size_t pos = 0;
+	while (pos < _pending.size()) {
+		const uint8_t* cmd = &_pending[pos];
+		size_t cmd_length = 1 + payload_length(cmd[0]);
+		if (pos + cmd_length > _pending.size()) {
+			break;
+		}
+		switch (cmd[0]) {
+			case OP_SET_LED_8:
+				if (_overlay) {
+					_overlay->set(read_uint16(cmd + 1),
+						color::from_8bit(cmd[3], cmd[4], cmd[5], cmd[6]));
+				}
+				break;
+			case OP_AUTHENTICATE:
+				authenticate(cmd + 1);
+				break;
+			case OP_SET_LED_16:
+				if (_overlay) {
+					_overlay->set(read_uint16(cmd + 1),
+						color(read_uint16(cmd + 3), read_uint16(cmd + 5),
+						      read_uint16(cmd + 7), read_uint16(cmd + 9)));
+				}
+				break;
+			case OP_STROBE:
+				if (_overlay) {
+					_mixer.strobe(*_overlay);
+				}
+				break;
+		}
+		pos += cmd_length;
+	}
+	_pending.erase(_pending.begin(), _pending.begin() + pos);
+}
+
+void session::authenticate(const uint8_t* token) {
+	if (_overlay) {
+		_mixer.release(_overlay);
+	}
+	_overlay = _server.get_overlay(std::string((const char*)token, TOKEN_SIZE));
+}
+
+///////////
+
+server::server(boost::asio::io_service& io, const settings& conf, mixer& mix):
+	_settings(conf),
+	_mixer(mix),
+	_acceptor(io, tcp::endpoint(boost::asio::ip::address::from_string(conf.interface), conf.port)),
+	_next_socket(io) {
+	for (auto& token: _settings.tokens) {
+		if (token.second.persistent) {
+			_persistent_overlays[token.first] =
+				_mixer.register_overlay(token.second.priority, true);
+		}
+	}
+	accept();
+}
+
+void server::accept() {
+	_acceptor.async_accept(_next_socket, [this](const boost::system::error_code& e){
+		if (e == boost::asio::error::operation_aborted) {
+			return;
+		}
+		if (!e) {
+			std::make_shared<session>(std::move(_next_socket), *this)->start();
+		}
+		accept();
+	});
+}
+
+overlay* server::get_overlay(const std::string& token) {
+	auto persistent = _persistent_overlays.find(token);
+	if (persistent != _persistent_overlays.end()) {
+		return persistent->second;
+	}
+	auto tok = _settings.tokens.find(token);
+	if (tok == _settings.tokens.end()) {
+		return nullptr;
+	}
+	return _mixer.register_overlay(tok->second.priority, false);
+}
@@ -0,0 +1,87 @@
+/*
+ *  This file is part of vaporpp.
+ *
+ *  vaporpp is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vaporpp is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vaporpp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef SERVER_HPP
+#define SERVER_HPP
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "mixer.hpp"
+#include "settings.hpp"
+
+class server;
+
+/**
+ * @brief One client connection speaking the low-level protocol (see HACKING).
+ */
+class session : public std::enable_shared_from_this<session> {
+	public:
+		session(boost::asio::ip::tcp::socket socket, server& srv);
+		~session();
+
+		/**
+		 * @brief Starts reading commands.
+		 */
+		void start();
+
+	private:
+		void read();
+		void process(size_t length);
+		void authenticate(const uint8_t* token);
+
+		boost::asio::ip::tcp::socket _socket;
+		server& _server;
+		// the session may outlive the server during shutdown:
+		mixer& _mixer;
+		overlay* _overlay = nullptr;
+		std::array<uint8_t, 4096> _read_buffer;
+		std::vector<uint8_t> _pending;
+};
+
+/**
+ * @brief Accepts client connections on the low-level port.
+ */
+class server {
+	public:
+		server(boost::asio::io_service& io, const settings& conf, mixer& mix);
+
+	private:
+		friend class session;
+
+		void accept();
+
+		/**
+		 * @brief Returns the overlay for a token or nullptr for unknown tokens.
+		 */
+		overlay* get_overlay(const std::string& token);
+
+		const settings& _settings;
+		mixer& _mixer;
+		boost::asio::ip::tcp::acceptor _acceptor;
+		boost::asio::ip::tcp::socket _next_socket;
+		std::map<std::string, overlay*> _persistent_overlays;
+};
+
+#endif // SERVER_HPP
@@ -0,0 +1,144 @@
+/*
+ *  This file is part of vaporpp.
+ *
+ *  vaporpp is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vaporpp is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vaporpp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "settings.hpp"
+
+#include <map>
+#include <stdexcept>
+
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+using boost::property_tree::ptree;
+
+enum { TOKEN_SIZE = 16 };
+
+namespace {
+
+void load_device(const ptree& tree, device_settings& dev) {
+	dev.type = tree.get<std::string>("type");
+	if (dev.type == "serial") {
+		dev.interface = tree.get<std::string>("interface");
+		dev.baudrate = tree.get<unsigned>("baudrate", dev.baudrate);
+	}
+	else if (dev.type == "network") {
+		dev.host = tree.get<std::string>("host");
+		dev.port = tree.get<uint16_t>("port");
+	}
+	else if (dev.type == "file") {
+		dev.path = tree.get<std::string>("path");
+	}
+	else {
+		throw std::runtime_error("invalid device type: " + dev.type);
+	}
+}
+
+vlpp::bus::channel_address load_channel(const ptree& tree) {
+	vlpp::bus::channel_address returnval;
+	if (tree.empty()) {
+		return returnval;
+	}
+	if (tree.size() != 2) {
+		throw std::runtime_error("a channel must be given as [module, position]");
+	}
+	auto it = tree.begin();
+	returnval.module = (uint8_t)it->second.get_value<unsigned>();
+	++it;
+	returnval.position = (uint8_t)it->second.get_value<unsigned>();
+	returnval.used = true;
+	return returnval;
+}
+
+} //anonymous namespace
+
+std::string pad_token(std::string token) {
+	token.resize(TOKEN_SIZE, '\0');
+	return token;
+}
+
+std::unique_ptr<vlpp::bus::device> device_settings::open() const {
+	if (type == "serial") {
+		return vlpp::bus::open_serial(interface, baudrate);
+	}
+	else if (type == "network") {
+		return vlpp::bus::open_socket(host, port);
+	}
+	else {
+		return vlpp::bus::open_file(path);
+	}
+}
+
+settings settings::load(const std::string& path) {
+	ptree tree;
+	boost::property_tree::read_json(path, tree);
+	settings returnval;
+
+	for (auto& token: tree.get_child("mixer.tokens")) {
+		if (token.first.size() > TOKEN_SIZE) {
+			throw std::runtime_error("token too long: " + token.first);
+		}
+		token_settings tok;
+		tok.priority = token.second.get<int>("priority");
+		tok.persistent = token.second.get<bool>("persistent", false);
+		returnval.tokens[pad_token(token.first)] = tok;
+	}
+
+	// either a single bus or a list of buses with their modules:
+	std::map<uint8_t, size_t> bus_of_module;
+	auto buses = tree.get_child_optional("hardware.buses");
+	if (buses) {
+		for (auto& bus: *buses) {
+			device_settings dev;
+			load_device(bus.second.get_child("device"), dev);
+			for (auto& module: bus.second.get_child("modules")) {
+				bus_of_module[(uint8_t)module.second.get_value<unsigned>()] = returnval.buses.size();
+			}
+			returnval.buses.push_back(dev);
+		}
+		if (returnval.buses.empty()) {
+			throw std::runtime_error("hardware.buses must not be empty");
+		}
+	}
+	else {
+		returnval.buses.resize(1);
+		load_device(tree.get_child("hardware.device"), returnval.buses.front());
+	}
+
+	// the modules first, so that the LEDs can be checked against them:
+	for (auto& module: tree.get_child("hardware.channels")) {
+		const auto address = (uint8_t)std::stoul(module.first);
+		returnval.channels.add_module(address, module.second.get_value<unsigned>(),
+				bus_of_module[address]);
+	}
+	for (auto& led: tree.get_child("mixer.channels")) {
+		vlpp::bus::led_channels channels;
+		if (led.second.size() != 3) {
+			throw std::runtime_error("LED " + led.first + " needs three channels");
+		}
+		size_t i = 0;
+		for (auto& channel: led.second) {
+			channels[i++] = load_channel(channel.second);
+		}
+		returnval.channels.assign((uint16_t)std::stoul(led.first), channels);
+	}
+
+	returnval.interface = tree.get<std::string>("server.lowlevel.interface", returnval.interface);
+	returnval.port = tree.get<uint16_t>("server.lowlevel.port", returnval.port);
+
+	return returnval;
+}
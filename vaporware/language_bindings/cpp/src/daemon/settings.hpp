@@ -0,0 +1,95 @@
+/*
+ *  This file is part of vaporpp.
+ *
+ *  vaporpp is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vaporpp is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vaporpp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef SETTINGS_HPP
+#define SETTINGS_HPP
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../bus/channel_map.hpp"
+#include "../bus/device.hpp"
+
+/**
+ * @brief How to reach a bus (see hardware.device in the config).
+ */
+struct device_settings {
+	std::string type = "file";
+	std::string interface;
+	unsigned baudrate = 500000;
+	std::string host;
+	uint16_t port = 0;
+	std::string path = "output.bin";
+
+	/**
+	 * @brief Opens the configured device.
+	 * @throws vlpp::bus::bus_error if the device cannot be opened
+	 */
+	std::unique_ptr<vlpp::bus::device> open() const;
+};
+
+/**
+ * @brief The properties of an access-token.
+ */
+struct token_settings {
+	int priority = 0;
+	bool persistent = false;
+};
+
+/**
+ * @brief The daemon configuration.
+ *
+ * The file is JSON and has the same structure as the application.conf
+ * of the scala daemon.
+ */
+struct settings {
+	/**
+	 * @brief the tokens, zero-padded to 16 bytes
+	 */
+	std::map<std::string, token_settings> tokens;
+
+	/**
+	 * @brief maps LED-IDs to hardware channels
+	 */
+	vlpp::bus::channel_map channels;
+
+	/**
+	 * @brief the buses; modules are on the first one unless assigned otherwise
+	 */
+	std::vector<device_settings> buses;
+
+	std::string interface = "0.0.0.0";
+	uint16_t port = 7534;
+
+	/**
+	 * @brief Reads the settings from a file.
+	 * @param path the path of the JSON-file
+	 * @throws std::runtime_error if the file cannot be read or is invalid
+	 */
+	static settings load(const std::string& path);
+};
+
+/**
+ * @brief Pads a token with zero-bytes to the size of a token.
+ */
+std::string pad_token(std::string token);
+
+#endif // SETTINGS_HPP
@@ -0,0 +1,140 @@
+/*
+ *  This file is part of vaporpp.
+ *
+ *  vaporpp is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vaporpp is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vaporpp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../bus/escape.hpp"
+#include "../bus/protocol.hpp"
+
+/*
+ * Checks that the vectorized escape() is bit-exact with escape_bytewise()
+ * and that the firmware gets the payload back, for all lengths around the
+ * block sizes, payloads full of marks and unaligned input.
+ */
+
+namespace {
+
+// the bytes after max_escaped_size() that escape() must not touch:
+const size_t GUARD = 16;
+const uint8_t GUARD_BYTE = 0xA5;
+
+int failures = 0;
+
+void check(bool condition, const std::string& what) {
+	if (!condition) {
+		// the first few are enough to see what's wrong:
+		if (failures < 20) {
+			std::cerr << "FAILED: " << what << std::endl;
+		}
+		++failures;
+	}
+}
+
+/*
+ * The unescaping done by read_command in led-boards/usart2.c.
+ * Returns false on a bad escape sequence or a stray start mark.
+ */
+bool unescape(const uint8_t* in, size_t length, std::vector<uint8_t>& out) {
+	using namespace vlpp::bus;
+	bool escape = false;
+	out.clear();
+	for (size_t i = 0; i < length; ++i) {
+		uint8_t byte = in[i];
+		if (escape) {
+			escape = false;
+			switch (byte) {
+				case 0x00: byte = ESCAPE_MARK; break;
+				case 0x01: byte = START_MARK; break;
+				default: return false;
+			}
+		}
+		else if (byte == ESCAPE_MARK) {
+			escape = true;
+			continue;
+		}
+		else if (byte == START_MARK) {
+			return false;
+		}
+		out.push_back(byte);
+	}
+	return !escape;
+}
+
+/*
+ * Escapes the payload with both implementations and checks that the
+ * firmware gets it back.
+ */
+void verify(const uint8_t* payload, size_t length) {
+	const size_t room = vlpp::bus::max_escaped_size(length);
+	std::vector<uint8_t> fast(room);
+	std::vector<uint8_t> reference(room);
+	std::vector<uint8_t> decoded;
+
+	fast.resize(vlpp::bus::escape(payload, length, fast.data()));
+	reference.resize(vlpp::bus::escape_bytewise(payload, length, reference.data()));
+	check(fast == reference, "escape() is bit-exact with escape_bytewise() at length " + std::to_string(length));
+	check(unescape(fast.data(), fast.size(), decoded) &&
+			decoded == std::vector<uint8_t>(payload, payload + length),
+			"the firmware decodes the payload at length " + std::to_string(length));
+
+	std::vector<uint8_t> guarded(room + GUARD, GUARD_BYTE);
+	vlpp::bus::escape(payload, length, guarded.data());
+	bool untouched = true;
+	for (size_t i = room; i < guarded.size(); ++i) {
+		untouched = untouched && guarded[i] == GUARD_BYTE;
+	}
+	check(untouched, "escape() stays within max_escaped_size() at length " + std::to_string(length));
+}
+
+} //anonymous namespace
+
+int main() {
+	std::mt19937 gen(42);
+	const std::uniform_int_distribution<int> distributions[] = {
+		std::uniform_int_distribution<int>(0, 255),
+		// mostly marks and their neighbours:
+		std::uniform_int_distribution<int>(0x53, 0x56),
+		std::uniform_int_distribution<int>(0x54, 0x55),
+	};
+
+	// the payloads start at every offset into a block, so the loads are unaligned:
+	std::vector<uint8_t> buffer(16 + 100);
+	size_t payloads = 0;
+	for (auto dist: distributions) {
+		for (size_t length = 0; length < 100; ++length) {
+			for (size_t offset = 0; offset < 16; ++offset) {
+				for (unsigned round = 0; round < 20; ++round) {
+					for (auto& byte: buffer) {
+						byte = uint8_t(dist(gen));
+					}
+					verify(buffer.data() + offset, length);
+					++payloads;
+				}
+			}
+		}
+	}
+
+	if (failures == 0) {
+		std::cout << payloads << " payloads escaped like the reference" << std::endl;
+	}
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,269 @@
+/*
+ *  This file is part of vaporpp.
+ *
+ *  vaporpp is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vaporpp is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vaporpp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../bus/channel_map.hpp"
+#include "../bus/device.hpp"
+#include "../bus/encoder.hpp"
+#include "../bus/frame_builder.hpp"
+#include "../bus/framer.hpp"
+#include "../bus/protocol.hpp"
+
+/*
+ * Checks which commands the frame_builder sends for a few patterns of
+ * changes, by decoding what arrives at the devices of two buses.
+ */
+
+namespace {
+
+using namespace vlpp::bus;
+
+// the number of RGB-LEDs per module in the test's channel map:
+const unsigned LEDS_PER_MODULE = 5;
+// a value that has to be escaped on the bus:
+const uint16_t MARKS = 0x5455;
+
+int failures = 0;
+
+void check(bool condition, const std::string& what) {
+	if (!condition) {
+		std::cerr << "FAILED: " << what << std::endl;
+		++failures;
+	}
+}
+
+struct command {
+	uint8_t address;
+	uint8_t code;
+	std::vector<uint8_t> args;
+};
+
+/*
+ * Decodes the frames written to it.
+ */
+class recording_device : public device {
+	public:
+		void write(const uint8_t* data, size_t length) override {
+			for (size_t i = 0; i < length; ++i) {
+				receive(data[i]);
+			}
+		}
+
+		// returns the commands received since the last call:
+		std::vector<command> take() {
+			std::vector<command> returnval;
+			for (auto& frame: _frames) {
+				if (frame.size() < 2) {
+					check(false, "frames have an address and a command");
+					continue;
+				}
+				returnval.push_back({ frame[0], frame[1], { frame.begin() + 2, frame.end() } });
+			}
+			_frames.clear();
+			return returnval;
+		}
+
+	private:
+		void receive(uint8_t byte) {
+			if (byte == START_MARK) {
+				_frames.emplace_back();
+				_escape = false;
+				return;
+			}
+			if (_frames.empty()) {
+				check(false, "the bytes start with a frame");
+				return;
+			}
+			if (byte == ESCAPE_MARK) {
+				_escape = true;
+				return;
+			}
+			_frames.back().push_back(_escape ? uint8_t(ESCAPE_MARK + byte) : byte);
+			_escape = false;
+		}
+
+		std::vector<std::vector<uint8_t>> _frames;
+		bool _escape = false;
+};
+
+/*
+ * A bus of the test: a device, its framer and its encoder.
+ */
+struct test_bus {
+	recording_device dev;
+	framer fr{dev};
+	encoder enc{fr};
+};
+
+uint16_t led(uint8_t module, unsigned index) {
+	return uint16_t(module * LEDS_PER_MODULE + index);
+}
+
+// declares the modules, each with LEDS_PER_MODULE LEDs on channels 0 to 14:
+void add_modules(channel_map& map, const std::vector<uint8_t>& modules, size_t bus) {
+	for (auto module: modules) {
+		map.add_module(module, MODULE_LENGTH, bus);
+		for (unsigned l = 0; l < LEDS_PER_MODULE; ++l) {
+			led_channels channels;
+			for (unsigned c = 0; c < 3; ++c) {
+				channels[c].used = true;
+				channels[c].module = module;
+				channels[c].position = uint8_t(3 * l + c);
+			}
+			map.assign(led(module, l), channels);
+		}
+	}
+}
+
+uint16_t read_int16(const std::vector<uint8_t>& args, size_t offset) {
+	return uint16_t(args[offset] << 8 | args[offset + 1]);
+}
+
+bool is_strobe(const command& cmd) {
+	return cmd.address == BROADCAST_ADDRESS && cmd.code == CMD_STROBE && cmd.args.empty();
+}
+
+// checks that commands are the given ones, each followed by the STROBE:
+void check_frame(const std::vector<command>& commands, const std::vector<std::pair<uint8_t, uint8_t>>& expected,
+		const std::string& what) {
+	bool ok = commands.size() == expected.size() + 1 && is_strobe(commands.back());
+	for (size_t i = 0; ok && i < expected.size(); ++i) {
+		ok = commands[i].address == expected[i].first && commands[i].code == expected[i].second;
+	}
+	check(ok, what);
+}
+
+void test_single_bus() {
+	channel_map map;
+	add_modules(map, { 1, 2, 3 }, 0);
+	test_bus bus;
+	frame_builder frames(map, bus.enc);
+
+	// the first strobe sends all modules, and three full ones are shorter in bulk:
+	check(frames.strobe() == 3, "the first strobe sends all modules");
+	auto commands = bus.dev.take();
+	check_frame(commands, { { BROADCAST_ADDRESS, CMD_BULK_RAW } }, "all modules go in one BULK_RAW");
+	if (commands.size() == 2) {
+		check(commands[0].args.size() == 2 + 3 * 2 * MODULE_LENGTH &&
+				commands[0].args[0] == 1 && commands[0].args[1] == 3,
+				"BULK_RAW covers modules 1 to 3 with all channels");
+	}
+
+	check(frames.strobe() == 0 && bus.dev.take().empty(), "nothing is sent without changes");
+
+	// one LED is shorter as SET_SPARSE:
+	frames.set(led(2, 1), MARKS, 0x0102, 0);
+	commands = bus.dev.take();
+	check(commands.empty(), "set() doesn't send anything");
+	check(frames.strobe() == 1, "only the changed module is sent");
+	commands = bus.dev.take();
+	check_frame(commands, { { 2, CMD_SET_SPARSE } }, "one changed LED goes in a SET_SPARSE");
+	if (commands.size() == 2) {
+		const auto& args = commands[0].args;
+		// blue was 0 already:
+		check(args.size() == 2 + 2 * 2 && read_int16(args, 0) == 0x0018 &&
+				read_int16(args, 2) == MARKS && read_int16(args, 4) == 0x0102,
+				"SET_SPARSE has the mask and the values of the changed channels");
+	}
+
+	frames.set(led(2, 1), MARKS, 0x0102, 0);
+	check(frames.strobe() == 0, "setting the same values changes nothing");
+	bus.dev.take();
+
+	// all LEDs of a module are as short as SET_RAW, which wins:
+	for (unsigned l = 0; l < LEDS_PER_MODULE; ++l) {
+		frames.set(led(1, l), 1, 2, 3);
+	}
+	check(frames.strobe() == 1, "one module with all LEDs changed is sent");
+	commands = bus.dev.take();
+	check_frame(commands, { { 1, CMD_SET_RAW } }, "a module with all LEDs changed goes in a SET_RAW");
+	if (commands.size() == 2) {
+		check(commands[0].args.size() == 2 * MODULE_LENGTH && read_int16(commands[0].args, 0) == 1 &&
+				read_int16(commands[0].args, 2 * 14) == 3 && read_int16(commands[0].args, 2 * 15) == 0,
+				"SET_RAW has all channels");
+	}
+
+	// two small changes are shorter separately than a bulk of three modules:
+	frames.set(led(3, 0), 7, 7, 7);
+	frames.set(led(1, 0), 8, 8, 8);
+	check(frames.strobe() == 2, "both changed modules are sent");
+	check_frame(bus.dev.take(), { { 3, CMD_SET_SPARSE }, { 1, CMD_SET_SPARSE } },
+			"small changes go separately, in the order they were made");
+
+	frames.invalidate();
+	check(frames.strobe() == 3, "invalidate() makes the next strobe send all modules");
+	check_frame(bus.dev.take(), { { BROADCAST_ADDRESS, CMD_BULK_RAW } }, "invalidate() sends everything again");
+
+	frames.set(led(3, 4), 9, 9, 9);
+	check(frames.strobe(std::chrono::milliseconds(300)) == 1, "a fade sends the changed module");
+	commands = bus.dev.take();
+	check_frame(commands, { { 3, CMD_FADE_RAW } }, "a fade goes in a FADE_RAW");
+	if (commands.size() == 2) {
+		check(commands[0].args.size() == 2 + 2 * MODULE_LENGTH && read_int16(commands[0].args, 0) == 300 &&
+				read_int16(commands[0].args, 2 + 2 * 12) == 9,
+				"FADE_RAW has the duration and all channels");
+	}
+}
+
+void test_gap() {
+	// modules 3 and 5 are not consecutive, so no BULK_RAW can cover them:
+	channel_map map;
+	add_modules(map, { 3, 5 }, 0);
+	test_bus bus;
+	frame_builder frames(map, bus.enc);
+	frames.strobe();
+	check_frame(bus.dev.take(), { { 3, CMD_SET_RAW }, { 5, CMD_SET_RAW } },
+			"modules with a gap in between are sent separately");
+}
+
+void test_two_buses() {
+	channel_map map;
+	add_modules(map, { 1, 2 }, 0);
+	add_modules(map, { 3 }, 1);
+	test_bus first;
+	test_bus second;
+	frame_builder frames(map, std::vector<encoder*>{ &first.enc, &second.enc });
+
+	// module 3 follows 1 and 2, but it is on another bus:
+	check(frames.strobe() == 3, "the first strobe sends the modules of all buses");
+	check_frame(first.dev.take(), { { BROADCAST_ADDRESS, CMD_BULK_RAW } }, "the first bus gets its modules in bulk");
+	check_frame(second.dev.take(), { { 3, CMD_SET_RAW } }, "the second bus gets its own module");
+
+	frames.set(led(3, 0), 1, 1, 1);
+	check(frames.strobe() == 1, "a change on one bus is sent");
+	check_frame(first.dev.take(), {}, "a bus without changes gets a bare STROBE");
+	check_frame(second.dev.take(), { { 3, CMD_SET_SPARSE } }, "the change goes to the bus of its module");
+}
+
+} //anonymous namespace
+
+int main() {
+	test_single_bus();
+	test_gap();
+	test_two_buses();
+
+	if (failures == 0) {
+		std::cout << "the frame builder sends what changed" << std::endl;
+	}
+	return failures == 0 ? 0 : 1;
+}
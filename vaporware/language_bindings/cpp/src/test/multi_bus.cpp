@@ -0,0 +1,149 @@
+/*
+ *  This file is part of vaporpp.
+ *
+ *  vaporpp is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vaporpp is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vaporpp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../bus/device.hpp"
+#include "../bus/multi_bus.hpp"
+#include "../bus/protocol.hpp"
+
+/*
+ * Drives a multi_bus over a good bus and one whose writes fail, as when a
+ * USB adapter is unplugged: both buses must fail with the error of the
+ * broken one, instead of the good one waiting for it to strobe forever.
+ */
+
+namespace {
+
+using vlpp::bus::bus_clock;
+
+// how long the buses may take to notice the failure:
+const auto TIMEOUT = std::chrono::seconds(2);
+// how long a good bus is watched for failing anyway:
+const auto GRACE = std::chrono::milliseconds(50);
+
+int failures = 0;
+
+void check(bool condition, const std::string& what) {
+	if (!condition) {
+		std::cerr << "FAILED: " << what << std::endl;
+		++failures;
+	}
+}
+
+class counting_device : public vlpp::bus::device {
+	public:
+		explicit counting_device(std::atomic<size_t>& bytes): _bytes(bytes) {}
+
+		void write(const uint8_t*, size_t length) override {
+			_bytes += length;
+		}
+
+	private:
+		std::atomic<size_t>& _bytes;
+};
+
+class broken_device : public vlpp::bus::device {
+	public:
+		void write(const uint8_t*, size_t) override {
+			throw vlpp::bus::bus_error("unplugged");
+		}
+};
+
+std::vector<uint8_t> frame_with_strobe() {
+	using namespace vlpp::bus;
+	return { START_MARK, 0x01, 0x02, 0x03, START_MARK, BROADCAST_ADDRESS, CMD_STROBE };
+}
+
+// returns the message of the error ready_at() or pending() throw, or "" on a timeout:
+std::string wait_for_error(vlpp::bus::device& bus, bus_clock::duration timeout = TIMEOUT) {
+	const auto until = bus_clock::now() + timeout;
+	while (bus_clock::now() < until) {
+		try {
+			bus.ready_at();
+			bus.pending();
+		} catch (vlpp::bus::bus_error& e) {
+			return e.what();
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	return "";
+}
+
+bool write_throws(vlpp::bus::device& bus) {
+	const auto frame = frame_with_strobe();
+	try {
+		bus.write(frame.data(), frame.size());
+	} catch (vlpp::bus::bus_error&) {
+		return true;
+	}
+	return false;
+}
+
+} //anonymous namespace
+
+int main() {
+	const auto frame = frame_with_strobe();
+
+	// 1. Two good buses strobe together and stay usable:
+	{
+		std::atomic<size_t> bytes_a{0};
+		std::atomic<size_t> bytes_b{0};
+		std::vector<std::unique_ptr<vlpp::bus::device>> devices;
+		devices.emplace_back(new counting_device(bytes_a));
+		devices.emplace_back(new counting_device(bytes_b));
+		vlpp::bus::multi_bus buses(std::move(devices));
+
+		buses[0].write(frame.data(), frame.size());
+		buses[1].write(frame.data(), frame.size());
+		const auto until = bus_clock::now() + TIMEOUT;
+		while ((bytes_a != frame.size() || bytes_b != frame.size()) && bus_clock::now() < until) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		check(bytes_a == frame.size() && bytes_b == frame.size(), "both buses write the whole frame");
+		check(wait_for_error(buses[0], GRACE).empty(), "a good bus doesn't fail");
+	}
+
+	// 2. One bus fails; the other one must not wait for it:
+	{
+		std::atomic<size_t> bytes{0};
+		std::vector<std::unique_ptr<vlpp::bus::device>> devices;
+		devices.emplace_back(new counting_device(bytes));
+		devices.emplace_back(new broken_device);
+		vlpp::bus::multi_bus buses(std::move(devices));
+
+		buses[0].write(frame.data(), frame.size());
+		buses[1].write(frame.data(), frame.size());
+		check(wait_for_error(buses[1]) == "unplugged", "the broken bus reports its error");
+		check(wait_for_error(buses[0]) == "unplugged", "the good bus fails with the error of the broken one");
+		check(write_throws(buses[0]) && write_throws(buses[1]), "no bus takes frames anymore");
+		check(bytes == frame.size() - 3, "the good bus doesn't strobe alone");
+	}
+
+	if (failures == 0) {
+		std::cout << "a failing bus stops all buses" << std::endl;
+	}
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,123 @@
+/*
+ *  This file is part of vaporpp.
+ *
+ *  vaporpp is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  vaporpp is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vaporpp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../bus/device.hpp"
+
+/*
+ * Writes to a serial port whose other end doesn't read, so that the kernel
+ * only takes part of the frames: the rest must be kept in order, counted by
+ * pending(), capped at MAX_PENDING_BYTES, and go out once the other end
+ * reads again. A pty stands in for the serial port.
+ */
+
+namespace {
+
+const size_t FRAME_LENGTH = 1000;
+// a limit for the frames written before the kernel has to refuse some:
+const size_t MAX_FRAMES = 10000;
+
+int failures = 0;
+
+void check(bool condition, const std::string& what) {
+	if (!condition) {
+		std::cerr << "FAILED: " << what << std::endl;
+		++failures;
+	}
+}
+
+int open_pty(std::string& slave) {
+	int master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0) {
+		std::cerr << "cannot open a pty" << std::endl;
+		std::exit(2);
+	}
+	fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+	slave = ptsname(master);
+	return master;
+}
+
+// reads what has arrived at the master side:
+void read_available(int master, std::vector<uint8_t>& received) {
+	uint8_t buffer[4096];
+	ssize_t length;
+	while ((length = read(master, buffer, sizeof(buffer))) > 0) {
+		received.insert(received.end(), buffer, buffer + length);
+	}
+}
+
+} //anonymous namespace
+
+int main() {
+	std::string slave;
+	const int master = open_pty(slave);
+	auto dev = vlpp::bus::open_serial(slave, 500000);
+
+	std::vector<uint8_t> sent;
+	std::vector<uint8_t> frame(FRAME_LENGTH);
+	size_t frames = 0;
+	bool short_write = false;
+	bool capped = false;
+
+	// 1. Nobody reads, so the kernel takes less and less:
+	while (frames < MAX_FRAMES) {
+		for (size_t i = 0; i < FRAME_LENGTH; ++i) {
+			frame[i] = uint8_t(frames * 7 + i);
+		}
+		try {
+			dev->write(frame.data(), frame.size());
+		} catch (vlpp::bus::bus_error&) {
+			capped = true;
+			break;
+		}
+		sent.insert(sent.end(), frame.begin(), frame.end());
+		++frames;
+		short_write = short_write || dev->pending() != 0;
+		check(dev->pending() <= vlpp::bus::MAX_PENDING_BYTES, "pending() stays below the cap");
+	}
+	check(short_write, "the kernel refused part of a frame");
+	check(capped, "write() throws once MAX_PENDING_BYTES pile up");
+	check(dev->pending() + FRAME_LENGTH > vlpp::bus::MAX_PENDING_BYTES,
+			"the frames are only refused at the cap");
+	check(dev->ready_at() > vlpp::bus::bus_clock::now(), "a backed up port is not ready");
+	check(dev->stats().frames == frames, "refused frames are not counted");
+
+	// 2. Read again; drain() hands over the rest:
+	std::vector<uint8_t> received;
+	for (size_t tries = 0; tries < MAX_FRAMES && (dev->pending() != 0 || received.size() < sent.size()); ++tries) {
+		read_available(master, received);
+		dev->drain();
+	}
+	read_available(master, received);
+	check(dev->pending() == 0, "drain() hands everything to the kernel");
+	check(received == sent, "the bytes arrive complete and in order");
+
+	close(master);
+	if (failures == 0) {
+		std::cout << frames << " frames written, all of them arrived" << std::endl;
+	}
+	return failures == 0 ? 0 : 1;
+}
@@ -4,17 +4,16 @@
 #include "debug.h"
 #include "fixedpoint.h"
 #include "term.h"
+#include "trace.h"
 
 static void mat_x_vec(fixed_t m[static 9], fixed_t x[static 3], fixed_t result[static 3]) {
-	result[0] = fixadd3(fixmul(m[0], x[0]), fixmul(m[1], x[1]), fixmul(m[2], x[2]));
-	result[1] = fixadd3(fixmul(m[3], x[0]), fixmul(m[4], x[1]), fixmul(m[5], x[2]));
-	result[2] = fixadd3(fixmul(m[6], x[0]), fixmul(m[7], x[1]), fixmul(m[8], x[2]));
+	result[0] = fixdot3(&m[0], x);
+	result[1] = fixdot3(&m[3], x);
+	result[2] = fixdot3(&m[6], x);
 }
 
 static fixed_t dot(fixed_t a[static 3], fixed_t b[static 3]) {
-	return fixadd3(fixmul(a[0], b[0]),
-		       fixmul(a[1], b[1]),
-		       fixmul(a[2], b[2]));
+	return fixdot3(a, b);
 }
 
 static fixed_t clamp(fixed_t x, fixed_t min, fixed_t max) {
@@ -27,6 +26,36 @@ static fixed_t clamp(fixed_t x, fixed_t min, fixed_t max) {
 	}
 }
 
+/*
+ * Returns floor(num * 65536 / den), saturated to 0xffff, for den > 0.
+ *
+ * There is no 64 bit division: den is normalized, a 16 bit estimate
+ * of it is inverted with a single 32 bit division (which the Cortex-M3
+ * has in hardware), and multiplying by this reciprocal gives a result
+ * that is at most 3 too small. The remainder tells us how much.
+ */
+static uint16_t fract_quotient(uint32_t num, uint32_t den) {
+	int shift = __builtin_clz(den);
+	uint32_t den_estimate = ((den << shift) >> 16) + 1;
+	uint32_t reciprocal = 0xffffffff / den_estimate;
+
+	uint64_t quotient = ((uint64_t) num * reciprocal) >> (32 - shift);
+	if (quotient >= 0xffff) {
+		return 0xffff;
+	}
+
+	uint64_t remainder = ((uint64_t) num << 16) - quotient * den;
+	while (remainder >= den) {
+		quotient++;
+		remainder -= den;
+	}
+
+	if (quotient > 0xffff) {
+		return 0xffff;
+	}
+	return (uint16_t) quotient;
+}
+
 /*
  * Performs color correction according to the given led_info_t.
  *
@@ -37,6 +66,7 @@ static fixed_t clamp(fixed_t x, fixed_t min, fixed_t max) {
 void color_correct(led_info_t info,
 		   uint16_t x, uint16_t y, uint16_t Y,
 		   uint16_t rgb[static 3]) {
+	trace_begin(TRACE_COLOR);
 
 	// First, get the ratio of the PWM channels right.  This is
 	// done by finding the barycentric coordinates of xyY within
@@ -56,29 +86,59 @@ void color_correct(led_info_t info,
 	// Approximate the desired color with one that is actually
 	// in the gamut (i.e. 0 <= rgb_ratio[i] <= 1).
 	// TODO This does not actually find the closest match.
+	fixed_t max_ratio = FIXNUM(0.0);
 	for (int i = 0; i < 3; i++) {
 		rgb_ratio[i] = clamp(rgb_ratio[i], FIXNUM(0.0), FIXNUM(1.0));
+		max_ratio = fixmax(max_ratio, rgb_ratio[i]);
 	}
 
 	// Now adjust for the desired luminosity.
 	// Note that the color takes precedence: If reproducing the
 	// color at the requested luminosity it not possible, it will
 	// be reproduced darker.
+	//
+	// The channels are scaled by min(Y / total_Y, 1 / max_ratio),
+	// so that none of them exceeds 1. This is the same as dividing
+	// by max(total_Y, Y * max_ratio), which needs only one division
+	// for all channels. All values here are non-negative, and
+	// Y * max_ratio (in 16.16) fits into 32 bits.
 	fixed_t total_Y = dot(rgb_ratio, info.peak_Y);
 
-	fixed_t scale = fixdiv(fixnum(Y), total_Y);
+	uint32_t denominator = (uint32_t) Y * (uint32_t) max_ratio.v;
+	if (fixgt(total_Y, FIXNUM(0.0)) && (uint32_t) total_Y.v > denominator) {
+		denominator = (uint32_t) total_Y.v;
+	}
 
-	for (int i = 0; i < 2; i++) {
-		if (fixne(rgb_ratio[i], FIXNUM(0.0))) {
-			scale = fixmin(scale,
-				       fixdiv(FIXNUM(1.0), rgb_ratio[i]));
+	for (int i = 0; i < 3; i++) {
+		if (denominator == 0) {
+			rgb[i] = 0;
+		} else {
+			rgb[i] = fract_quotient((uint32_t) rgb_ratio[i].v * Y, denominator);
 		}
 	}
 
-	for (int i = 0; i < 3; i++) {
-		rgb_ratio[i] = fixmul(rgb_ratio[i], scale);
-		rgb[i] = fix_fract_part(rgb_ratio[i]);
+	trace_end(TRACE_COLOR);
+}
+
+/*
+ * Expands an 8 bit value to a PWM value using the gamma curve in
+ * config.gamma.
+ */
+uint16_t gamma_expand(uint8_t value) {
+	_Static_assert(GAMMA_POINTS == 33, "gamma_expand assumes steps of 8");
+
+	// Scale 0..255 to 0..256, so that 255 hits the last point.
+	unsigned scaled = value + (value >> 7);
+	unsigned point = scaled >> 3;
+	unsigned weight = scaled & 7;
+
+	if (weight == 0) {
+		return config.gamma[point];
 	}
+
+	int32_t low = config.gamma[point];
+	int32_t high = config.gamma[point + 1];
+	return low + (high - low) * (int32_t) weight / 8;
 }
 
 /*
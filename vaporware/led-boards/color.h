@@ -16,6 +16,12 @@ void color_correct(led_info_t info,
 		   uint16_t x, uint16_t y, uint16_t Y,
 		   uint16_t rgb[static 3]);
 
+/*
+ * Expands an 8 bit value to a PWM value using the gamma curve in
+ * config.gamma.
+ */
+uint16_t gamma_expand(uint8_t value);
+
 /*
  * Converts a flatly counted channel index (i.e. 0 to 15 standing for
  * LED0 red, LED0 green, LED0 blue, LED1 red, ...) to the PWM channel
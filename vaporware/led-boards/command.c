@@ -4,7 +4,9 @@
 #include "config.h"
 #include "console.h"
 #include "debug.h"
+#include "main.h"
 #include "pwm.h"
+#include "sync.h"
 #include "usart2.h"
 #include "term.h"
 
@@ -13,9 +15,48 @@
  */
 static const uint8_t BROADCAST = 0xff;
 
+/*
+ * The key a "config mode" command must carry, so that a stray or
+ * corrupted frame doesn't reset a module into the config console.
+ */
+static const uint32_t CONFIG_MODE_KEY = 0xc0f1c0de;
+
+/*
+ * The address of the frame being received. Only used by the parser.
+ */
+static uint8_t rx_address;
+
+/*
+ * The number of strobes run, for the bus statistics.
+ */
+static uint32_t strobes = 0;
+
+/*
+ * The last color set with "set LEDs xyY" for each LED and the PWM
+ * values it was corrected to. When only some LEDs change from frame to
+ * frame, this saves color_correct for the others. The config can't
+ * change in normal mode, so the entries stay valid once set.
+ */
+typedef struct {
+	bool valid;
+	uint16_t x, y, Y;
+	uint16_t rgb[3];
+} xyY_cache_t;
+
+static xyY_cache_t xyY_cache[RGB_LED_COUNT];
+static uint32_t xyY_hits = 0;
+static uint32_t xyY_misses = 0;
+
 typedef enum {
 	CMD_SET_RAW = 0x00,
 	CMD_SET_XYY = 0x01,
+	CMD_FADE_RAW = 0x02,
+	CMD_SET_SPARSE = 0x03,
+	CMD_SET_RAW8 = 0x04,
+	CMD_BULK_RAW = 0x05,
+	CMD_TIME_SYNC = 0x06,
+	CMD_STROBE_AT = 0x07,
+	CMD_CONFIG_MODE = 0x08,
 	CMD_STROBE = 0xff
 } commant_t;
 
@@ -31,18 +72,42 @@ static bool address_filter(uint8_t address) {
 	debug_putchar(config.my_address);
 #endif
 
+	rx_address = address;
+
 	return address == config.my_address ||
 		address == BROADCAST;
 }
 
+/*
+ * Size of the slice of one module in a "bulk raw" command.
+ */
+#define BULK_SLICE_LEN (sizeof(uint16_t) * MODULE_LENGTH)
+
+/*
+ * Returns whether a "bulk raw" command for the given range of modules
+ * contains a slice for this module.
+ */
+static bool in_bulk_range(uint8_t first, uint8_t count) {
+	return config.my_address >= first &&
+		config.my_address - first < count;
+}
+
 /*
  * The USART length check function.
  *
  * This function checks the first byte of command_prefix (which is the
  * command code) and calculates the remaining bytes necessary from the
  * fixed length of each command.
+ *
+ * Of a "bulk raw" command, only the header and the slice of this
+ * module are stored; the slices before it are skipped and the command
+ * ends after it. If there is no slice for this module, the command is
+ * dropped as soon as the header is complete.
+ *
+ * A "config mode" command is dropped if it was sent to the broadcast
+ * address, which must never take all modules off the bus at once.
  */
-static int length_check(uint8_t *command_prefix, int length_so_far) {
+static int length_check(uint8_t *command_prefix, int length_so_far, int *skip) {
 	if (length_so_far == 0) {
 		// This should not even happen, but better be prepared.
 		// We want to see at least the command code.
@@ -58,6 +123,44 @@ static int length_check(uint8_t *command_prefix, int length_so_far) {
 		case CMD_SET_XYY:
 			total_length = 1 + (sizeof(uint16_t) * 3 * RGB_LED_COUNT);
 			break;
+		case CMD_FADE_RAW:
+			total_length = 1 + sizeof(uint16_t) + (sizeof(uint16_t) * MODULE_LENGTH);
+			break;
+		case CMD_SET_RAW8:
+			total_length = 1 + MODULE_LENGTH;
+			break;
+		case CMD_BULK_RAW:
+			if (length_so_far < 3) {
+				total_length = 3;
+			} else if (length_so_far > 3) {
+				// We have our slice.
+				total_length = length_so_far;
+			} else if (in_bulk_range(command_prefix[1], command_prefix[2])) {
+				*skip = (config.my_address - command_prefix[1]) * BULK_SLICE_LEN;
+				total_length = 3 + BULK_SLICE_LEN;
+			} else {
+				return USART_DROP_COMMAND;
+			}
+			break;
+		case CMD_SET_SPARSE:
+			// The channel mask tells how many values follow.
+			if (length_so_far < 3) {
+				total_length = 3;
+			} else {
+				uint16_t mask = (command_prefix[1] << 8) + command_prefix[2];
+				total_length = 3 + (sizeof(uint16_t) * __builtin_popcount(mask));
+			}
+			break;
+		case CMD_CONFIG_MODE:
+			if (rx_address == BROADCAST) {
+				return USART_DROP_COMMAND;
+			}
+			total_length = 1 + sizeof(uint32_t);
+			break;
+		case CMD_TIME_SYNC:
+		case CMD_STROBE_AT:
+			total_length = 1 + sizeof(uint32_t);
+			break;
 		case CMD_STROBE:
 			total_length = 1;
 			break;
@@ -79,6 +182,10 @@ static int length_check(uint8_t *command_prefix, int length_so_far) {
 void command_init() {
 	usart2_set_address_filter(address_filter);
 	usart2_set_length_check(length_check);
+
+	for (int l = 0; l < RGB_LED_COUNT; l++) {
+		xyY_cache[l].valid = false;
+	}
 }
 
 /*
@@ -88,6 +195,10 @@ static error_t run_set_raw(uint8_t *args) {
 #ifdef TRACE_COMMANDS
 	console_write("raw");
 #endif
+	// Show the new values at once, even if an earlier command
+	// asked for a fade.
+	pwm_set_fade(0);
+
 	int i = 0;
 
 	for (uint8_t c = 0; c < MODULE_LENGTH; c++, i+=2) {
@@ -102,6 +213,90 @@ static error_t run_set_raw(uint8_t *args) {
 	return E_SUCCESS;
 }
 
+/*
+ * Runs a "set LEDs raw 8 bit" command. The values are expanded to
+ * PWM values with the configured gamma curve.
+ */
+static error_t run_set_raw8(uint8_t *args) {
+#ifdef TRACE_COMMANDS
+	console_write("raw8");
+#endif
+	pwm_set_fade(0);
+
+	for (uint8_t c = 0; c < MODULE_LENGTH; c++) {
+		uint8_t pwm_channel = convert_channel_index(c);
+
+		error_t error = pwm_set_brightness(pwm_channel, gamma_expand(args[c]));
+
+		if (error) return error;
+	}
+
+	return E_SUCCESS;
+}
+
+/*
+ * Runs a "bulk raw" command. The arguments are the address of the
+ * first module and the number of modules in the command, followed by
+ * the slice of this module, which is the same as the arguments of
+ * "set LEDs raw". If the command has no slice for us, there is only
+ * the header.
+ */
+static error_t run_bulk_raw(uint8_t *args) {
+	// The length check has dropped the commands without a slice
+	// for this module.
+	return run_set_raw(args + 2);
+}
+
+/*
+ * Runs a "set LEDs sparse" command. The first argument is a mask of the
+ * channels to set (bit c for channel c), followed by their values in
+ * the order of the channels.
+ */
+static error_t run_set_sparse(uint8_t *args) {
+#ifdef TRACE_COMMANDS
+	console_write("sparse");
+#endif
+	pwm_set_fade(0);
+
+	uint16_t mask = (args[0] << 8) + args[1];
+	int i = 2;
+
+	for (uint8_t c = 0; c < MODULE_LENGTH; c++) {
+		if (!(mask & (1 << c))) {
+			continue;
+		}
+
+		uint16_t value = (args[i] << 8) + args[i+1];
+		i += 2;
+		uint8_t pwm_channel = convert_channel_index(c);
+
+		error_t error = pwm_set_brightness(pwm_channel, value);
+
+		if (error) return error;
+	}
+
+	return E_SUCCESS;
+}
+
+/*
+ * Runs a "fade LEDs raw" command. The first argument is the duration
+ * of the fade in milliseconds, the rest is the same as for "set LEDs
+ * raw".
+ */
+static error_t run_fade_raw(uint8_t *args) {
+#ifdef TRACE_COMMANDS
+	console_write("fade");
+#endif
+	uint16_t duration = (args[0] << 8) + args[1];
+
+	error_t error = run_set_raw(args + 2);
+	if (error) return error;
+
+	pwm_set_fade(duration);
+
+	return E_SUCCESS;
+}
+
 /*
  * Runs a "set LEDs xyY" command.
  */
@@ -109,9 +304,7 @@ static error_t run_set_xyY(uint8_t *args) {
 #ifdef TRACE_COMMANDS
 	console_write("xyY");
 #endif
-#ifdef COUNT_SET_LEDS
-	cycle_start();
-#endif
+	pwm_set_fade(0);
 
 	int i = 0;
 	for (uint8_t l = 0; l < RGB_LED_COUNT; l++, i+=6) {
@@ -121,8 +314,18 @@ static error_t run_set_xyY(uint8_t *args) {
 		uint16_t y = (args[i+2] << 8) + args[i+3];
 		uint16_t Y = (args[i+4] << 8) + args[i+5];
 
-		uint16_t rgb[3];
-		color_correct(info, x, y, Y, rgb);
+		xyY_cache_t *cached = &xyY_cache[l];
+		if (cached->valid && cached->x == x && cached->y == y && cached->Y == Y) {
+			xyY_hits++;
+		} else {
+			color_correct(info, x, y, Y, cached->rgb);
+			cached->x = x;
+			cached->y = y;
+			cached->Y = Y;
+			cached->valid = true;
+			xyY_misses++;
+		}
+		uint16_t *rgb = cached->rgb;
 
 #ifdef TRACE_COMMANDS
 		console_uint_d(l); console_write(" ");
@@ -140,18 +343,60 @@ static error_t run_set_xyY(uint8_t *args) {
 		}
 	}
 
-#ifdef COUNT_SET_LEDS
-	int cycles = cycle_get();
-	console_write("Set LED cycles: ");
-	console_uint_d(cycles);
-	console_write(CRLF);
-#endif
 #ifdef TRACE_COMMANDS
 	console_write("Done" CRLF);
 #endif
 	return E_SUCCESS;
 }
 
+/*
+ * Reads a big endian 32 bit number from a command.
+ */
+static uint32_t read_uint32(uint8_t *args) {
+	return ((uint32_t) args[0] << 24) | ((uint32_t) args[1] << 16) |
+		((uint32_t) args[2] << 8) | args[3];
+}
+
+/*
+ * Runs a "time sync" command, which sets the board time in ms.
+ */
+static error_t run_time_sync(uint8_t *args) {
+#ifdef TRACE_COMMANDS
+	console_write("sync");
+#endif
+	// The time was current when the command was received. Add the
+	// time it waited in the queue, and don't lose a tick of the
+	// systick while doing so.
+	atomic_add(&board_time, read_uint32(args) - usart2_received_at());
+
+	return E_SUCCESS;
+}
+
+/*
+ * Runs a "strobe at" command, which schedules the current frame to be
+ * shown at the given board time.
+ */
+static error_t run_strobe_at(uint8_t *args) {
+#ifdef TRACE_COMMANDS
+	console_write("@");
+#endif
+	strobes++;
+	return pwm_send_frame_at(read_uint32(args));
+}
+
+/*
+ * Runs a "config mode" command, which resets the module into config
+ * mode if it carries CONFIG_MODE_KEY.
+ */
+static error_t run_config_mode(uint8_t *args) {
+	if (read_uint32(args) != CONFIG_MODE_KEY) {
+		return E_WRONGCOMMAND;
+	}
+
+	console_request_config_mode();
+	return E_SUCCESS;
+}
+
 /*
  * Runs the command pointed to by 'command'.
  *
@@ -165,13 +410,53 @@ error_t run_command(uint8_t *command) {
 	case CMD_SET_XYY:
 		return run_set_xyY(command + 1);
 		break;
+	case CMD_FADE_RAW:
+		return run_fade_raw(command + 1);
+		break;
+	case CMD_SET_SPARSE:
+		return run_set_sparse(command + 1);
+		break;
+	case CMD_SET_RAW8:
+		return run_set_raw8(command + 1);
+		break;
+	case CMD_BULK_RAW:
+		return run_bulk_raw(command + 1);
+		break;
+	case CMD_TIME_SYNC:
+		return run_time_sync(command + 1);
+		break;
+	case CMD_STROBE_AT:
+		return run_strobe_at(command + 1);
+		break;
+	case CMD_CONFIG_MODE:
+		return run_config_mode(command + 1);
+		break;
 	case CMD_STROBE:
 #ifdef TRACE_COMMANDS
 		console_write("!");
 #endif
+		strobes++;
 		return pwm_send_frame();
 		break;
 	default:
 		return E_WRONGCOMMAND;
 	}
 }
+
+/*
+ * Returns the number of strobes (including scheduled ones) run since
+ * startup.
+ */
+uint32_t command_strobe_count() {
+	return strobes;
+}
+
+/*
+ * Returns the number of LEDs in "set LEDs xyY" commands whose color
+ * was found in the cache (hits) or had to be corrected (misses) since
+ * startup.
+ */
+void command_xyY_cache_stats(uint32_t *hits, uint32_t *misses) {
+	*hits = xyY_hits;
+	*misses = xyY_misses;
+}
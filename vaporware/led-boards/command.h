@@ -36,4 +36,17 @@ int command_length(char command_code);
  */
 error_t run_command(uint8_t *command);
 
+/*
+ * Returns the number of strobes (including scheduled ones) run since
+ * startup.
+ */
+uint32_t command_strobe_count();
+
+/*
+ * Returns the number of LEDs in "set LEDs xyY" commands whose color
+ * was found in the cache (hits) or had to be corrected (misses) since
+ * startup.
+ */
+void command_xyY_cache_stats(uint32_t *hits, uint32_t *misses);
+
 #endif
@@ -11,6 +11,7 @@
  */
 
 config_entry_t config = {
+	.layout = CONFIG_LAYOUT,
 	.my_address = 0x00fd,
 	.heat_limit = REPEAT(0xffff, HEAT_SENSOR_LEN),
 	.led_infos = {
@@ -105,6 +106,18 @@ config_entry_t config = {
 			}
 		}
 	},
+	// Gamma 2.2
+	.gamma = {
+		0, 32, 147, 359, 676, 1104, 1648, 2314,
+		3104, 4022, 5072, 6255, 7574, 9033, 10632, 12375,
+		14263, 16298, 18482, 20816, 23303, 25943, 28739, 31692,
+		34802, 38072, 41503, 45097, 48853, 52774, 56860, 61114,
+		65535
+	},
+	// Without a better map, every sensor dims the whole module.
+	.heat_channels = REPEAT(0xffff, HEAT_SENSOR_LEN),
+	.dither_channels = 0,
+	.end_aligned_channels = 0,
 };
 
 /*
@@ -123,6 +136,9 @@ config_entry_t config = {
  */
 #define ENTRY_COUNT (FLASH_PAGE_SIZE * CONFIG_PAGES /             \
 		     (sizeof(config_entry_t) + sizeof(uint16_t)))
+// With a single slot, every save would first erase the configuration
+// in use, and a reset in between would lose it.
+_Static_assert(ENTRY_COUNT >= 2, "config_entry_t is too large for two slots in the config page");
 typedef struct {
 	uint16_t entry_status[ENTRY_COUNT];
 
@@ -133,6 +149,7 @@ config_page_t config_page __attribute__ ((section (".config"))) = {
 	.entry_status = REPEAT(0xffff, ENTRY_COUNT),
 	.entries = {
 		[0 ... ENTRY_COUNT - 1] = {
+			.layout = 0xffff,
 			.my_address = 0xffff,
 			.heat_limit = REPEAT(0xffff, HEAT_SENSOR_LEN),
 			.led_infos = {
@@ -142,7 +159,11 @@ config_page_t config_page __attribute__ ((section (".config"))) = {
 					.channels = REPEAT(0xff, 3)
 				}
 			},
-			.backup_channel = 0xff
+			.backup_channel = 0xff,
+			.gamma = REPEAT(0xffff, GAMMA_POINTS),
+			.heat_channels = REPEAT(0xffff, HEAT_SENSOR_LEN),
+			.dither_channels = 0xffff,
+			.end_aligned_channels = 0xffff
 		}
 	}
 };
@@ -151,6 +172,11 @@ config_page_t config_page __attribute__ ((section (".config"))) = {
  * Loads the configuration stored in flash. If no configuration is found,
  * an E_NOCONFIG is returned.
  *
+ * The slots move whenever config_entry_t changes, and a new firmware
+ * doesn't erase the config page, so a configuration with another
+ * layout is not loaded at all. An invalid one is loaded so that it
+ * can be fixed in the console, but E_NOCONFIG is returned as well.
+ *
  * Returns an error/success code.
  */
 error_t load_config() {
@@ -172,8 +198,16 @@ error_t load_config() {
 		return E_NOCONFIG;
 	}
 
+	if (config_page.entries[in_use].layout != CONFIG_LAYOUT) {
+		return E_NOCONFIG;
+	}
+
 	config = config_page.entries[in_use];
 
+	if (!config_valid()) {
+		return E_NOCONFIG;
+	}
+
 	return E_SUCCESS;
 }
 
@@ -293,7 +327,14 @@ int config_valid() {
 
 	for (int l = 0; l < RGB_LED_COUNT; l++) {
 		for (int c = 0; c < 3; c++) {
-			led_seen[config.led_infos[l].channels[c]]++;
+			uint8_t channel = config.led_infos[l].channels[c];
+			if (channel >= MODULE_LENGTH) {
+				console_write(CHANNEL_ASSIGNMENT_IS_INVALID);
+				console_uint_d(channel);
+				console_write(CRLF);
+				return 0;
+			}
+			led_seen[channel]++;
 		}
 	}
 
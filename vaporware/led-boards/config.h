@@ -40,31 +40,68 @@ static volatile uint32_t * const TIMER_CHANNELS[MODULE_LENGTH] = {
 	&TR(TIM17, CCR1)
 };
 
-// Baud rate register for the USARTs.
-#if BUS_BAUDRATE == 115200
-// Divider 13.0 * 16 = 208.3: 115200 baud at 24MHz
-static const int USART_BAUD_VALUE = (13 << 4) | 0;
-#else
- #if BUS_BAUDRATE == 500000
-// Divider 3.0 * 16 = 48.0: 500000 baud at 24MHz
-static const int USART_BAUD_VALUE = (3 << 4) | 0;
- #else
-  #error "Only baud rates 115200 and 500000 are supported"
- #endif
+// Clock of the USARTs (PCLK1 for USART2, PCLK2 for USART1; both run
+// undivided from the 24MHz system clock).
+#define USART_CLOCK 24000000
+
+// Baud rate register value for a baud rate. The USARTs divide their clock by
+// 16 * USARTDIV, where USARTDIV is a fixed point number with four
+// fractional bits, so the register value is just USART_CLOCK / baudrate,
+// rounded to the nearest integer.
+#define USART_BAUD_DIVIDER(baudrate) (((USART_CLOCK) + (baudrate) / 2) / (baudrate))
+
+// The baud rate a register value actually results in.
+#define USART_ACTUAL_BAUDRATE(brr) ((USART_CLOCK) / (brr))
+
+// Maximum deviation from the requested baud rate, in 1/1000. Each side
+// of the bus may be off by this much; the receiver tolerates about 3.75%
+// in total.
+#define USART_MAX_BAUD_ERROR 15
+
+#define USART_BAUD_ERROR(baudrate) \
+	((USART_ACTUAL_BAUDRATE(USART_BAUD_DIVIDER(baudrate)) > (baudrate) ? \
+	  USART_ACTUAL_BAUDRATE(USART_BAUD_DIVIDER(baudrate)) - (baudrate) : \
+	  (baudrate) - USART_ACTUAL_BAUDRATE(USART_BAUD_DIVIDER(baudrate))) * 1000 / (baudrate))
+
+#ifndef BUS_BAUDRATE
+ #error "BUS_BAUDRATE must be set (see Makefile)"
+#endif
+#if USART_BAUD_DIVIDER(BUS_BAUDRATE) < 16
+ // USARTDIV must be at least 1.0: the fastest rate is USART_CLOCK / 16.
+ #error "BUS_BAUDRATE is too high for the USART clock (max. 1500000 baud)"
 #endif
-// Divider 13.0 * 16 = 208.3: 115200 baud at 24MHz
-static const int CONSOLE_BAUD_VALUE = (13 << 4) | 0;
+#if USART_BAUD_ERROR(BUS_BAUDRATE) > USART_MAX_BAUD_ERROR
+ #error "BUS_BAUDRATE can't be generated accurately enough from the USART clock"
+#endif
+
+// Baud rate register for the bus USART.
+static const int USART_BAUD_VALUE = USART_BAUD_DIVIDER(BUS_BAUDRATE);
 
-// Timeout for the user reaction to enter config mode, in ms.
+// Baud rate register for the console USART.
+#define CONSOLE_BAUDRATE 115200
+static const int CONSOLE_BAUD_VALUE = USART_BAUD_DIVIDER(CONSOLE_BAUDRATE);
+
+// Timeout for the user reaction to enter config mode, in ms. The
+// board only asks if it has no valid configuration.
 static const int ASK_MODE_TIMEOUT = 3000;
 
+// Value of the backup register BKP_DR1 that makes the board start in
+// config mode after the next reset.
+#define CONFIG_MODE_REQUEST 0xc0f1
+
 // Number of failures on which to raise an error.
 static const int USART_FAIL_TRESHOLD = 20;
 
-// Number of USART command buffers.
-#define USART_BUFFER_COUNT 4
-// Length of a USART command buffer
+// Size of the ring buffer the DMA receives the bus traffic into. Each
+// half is parsed in the interrupt when the DMA has filled it, so this
+// only has to cover the interrupt latency: 128 bytes = 1.3ms at 1 Mbaud.
+#define USART_RX_RING_LEN 256
+// Maximum length of a USART command
 #define CMD_BUFFER_LEN 36
+// Number of commands that can be queued for the main loop. The queue
+// takes the RAM left over (see linker.ld), so for commands of a few
+// bytes, like strobes, this is the limit.
+#define CMD_FRAME_COUNT 32
 
 // Start-of-command marker
 #define START_MARK 0x55
@@ -100,6 +137,31 @@ static const uint8_t HEAT_ADC_PORTS[HEAT_SENSOR_LEN] = {
 	#define PWM_RELOAD ((1 << PWM_BITS) - 1)
 #endif
 
+// The clock of the PWM timers (the undivided system clock).
+#define PWM_CLOCK 24000000
+
+// Upper limit for the number of steps of a fade (see pwm_set_fade).
+// At 16 bits, a PWM period is 2.7ms, so this is more than 90s.
+#define PWM_FADE_MAX_STEPS 0x7fff
+
+// Number of bits the channels in config.dither_channels get in addition
+// to the PWM_BITS of the timers, by temporal dithering. The pattern
+// repeats after at most 2^PWM_DITHER_BITS PWM periods (22ms for 3 bits),
+// more would flicker visibly.
+#define PWM_DITHER_BITS 3
+
+// Number of frames that can be scheduled with the "strobe at" command
+// before they are shown.
+#define PWM_SCHEDULE_LEN 4
+
+// Number of systicks (1ms) between two heat checks.
+#define TICKS_PER_HEAT_CHECK 100
+
+// Number of events kept by the cycle trace (see trace.h). Each takes
+// 8 bytes of RAM, and only with TRACE_CYCLES. This comes out of the
+// command queue (see linker.ld).
+#define TRACE_RING_LEN 64
+
 // Sample time for the heat sensors.
 #define ADC_SAMPLE_TIME 0x7 // 239.5 cycles (50kHz)
 static const int ADC_SAMPLE_TIME_1 =
@@ -124,9 +186,29 @@ static const int ADC_SAMPLE_TIME_2 =
 	((ADC_SAMPLE_TIME & 0x7) << 24) |
 	((ADC_SAMPLE_TIME & 0x7) << 27);
 
+// Number of samples per heat sensor that are averaged for a heat check.
+// The ADC converts each sensor every 126us, so they cover the last 1ms.
+#define HEAT_OVERSAMPLING 8
+
 // Number of failures on which to raise an error.
 static const int HEAT_FAIL_TRESHOLD = 20;
 
+// Each heat check moves the filtered temperature of a sensor by
+// 1/2^HEAT_FILTER_SHIFT of the way to its current average.
+#define HEAT_FILTER_SHIFT 3
+
+// Distance below the heat limit (in ADC counts) at which a sensor
+// starts to dim the channels near it. They are dimmed linearly down to
+// HEAT_DERATE_MIN (in 1/PWM_FULL_OUTPUT) at the limit. Above the
+// limit, the board is switched off.
+#define HEAT_DERATE_RANGE 256
+#define HEAT_DERATE_MIN (PWM_FULL_OUTPUT / 4)
+
+// The channels near a sensor are only brightened again when it has
+// cooled down this much (in ADC counts) below the temperature they
+// were dimmed at.
+#define HEAT_DERATE_HYSTERESIS 32
+
 // Initial contents of Flash.
 // This should be the value that the Flash contains when not programmed.
 static const uint8_t EEPROM_EMPTY = 0xFF;
@@ -186,10 +268,27 @@ typedef struct {
 	uint8_t channels[3];
 } __attribute__ ((packed)) led_info_t;
 
+/*
+ * Number of points of the gamma curve for 8 bit values. Point i is
+ * the PWM value for 255 * i / (GAMMA_POINTS - 1); the values in
+ * between are interpolated linearly.
+ */
+#define GAMMA_POINTS 33
+
+/*
+ * The layout of config_entry_t: 0x76 ('v') and a version, which must
+ * be incremented whenever config_entry_t changes. A configuration
+ * stored by a firmware with another layout is not loaded.
+ */
+#define CONFIG_LAYOUT 0x7601
+
 /*
  * Struct for a complete set of configuration.
  */
 typedef struct {
+	// CONFIG_LAYOUT of the firmware that stored this configuration.
+	uint16_t layout;
+
 	// This module's address.
 	// It is stored as a 16-bit integer so that the whole struct has a size
 	// divisible by sizeof(uint16_t).
@@ -203,6 +302,22 @@ typedef struct {
 
 	// The channel that is not used by any LED.
 	uint8_t backup_channel;
+
+	// Gamma curve to expand 8 bit values from the bus to PWM values.
+	uint16_t gamma[GAMMA_POINTS];
+
+	// The PWM channels near each heat sensor (bit c for channel c),
+	// which are dimmed when it gets hot.
+	uint16_t heat_channels[HEAT_SENSOR_LEN];
+
+	// The PWM channels (bit c for channel c) that are dithered to
+	// show values between two PWM steps (see pwm.c).
+	uint16_t dither_channels;
+
+	// The PWM channels (bit c for channel c) whose pulses end at the
+	// end of the PWM period instead of starting at its beginning, to
+	// spread the switching of the channels (see pwm.c).
+	uint16_t end_aligned_channels;
 } __attribute__ ((packed)) config_entry_t;
 
 /*
@@ -212,7 +327,7 @@ extern config_entry_t config;
 
 /*
  * Loads the configuration stored in flash. If no configuration is found,
- * E_NOCONFIG is returned.
+ * or it has another layout or is invalid, E_NOCONFIG is returned.
  *
  * Returns an error/success code.
  */
@@ -11,8 +11,14 @@
 #include "console_prompt.h"
 #include "error.h"
 #include "term.h"
+#include "trace.h"
 #include "usart1.h"
+#include "usart2.h"
 
+#include "stm_include/stm32/bkp.h"
+#include "stm_include/stm32/gpio.h"
+#include "stm_include/stm32/pwr.h"
+#include "stm_include/stm32/scb.h"
 #include "stm_include/stm32/usart.h"
 
 #define LINE_LENGTH 80
@@ -235,6 +241,37 @@ vl_mode_t console_ask_mode() {
 	}
 }
 
+/*
+ * Returns whether config mode was requested for this boot, either
+ * with console_request_config_mode before the last reset, or by
+ * pulling the console RX line (PA10) low while the board starts, eg.
+ * with a jumper from RX to GND on the console header. The request
+ * from before the reset is cleared.
+ */
+bool console_config_requested() {
+	bool requested = (BKP_DR1 == CONFIG_MODE_REQUEST);
+
+	if (requested) {
+		PWR_CR |= PWR_CR_DBP;
+		BKP_DR1 = 0;
+		PWR_CR &= ~PWR_CR_DBP;
+	}
+
+	return requested || !(GPIOA_IDR & GPIO10);
+}
+
+/*
+ * Resets the board into config mode.
+ */
+void console_request_config_mode() {
+	// The backup registers survive a system reset.
+	PWR_CR |= PWR_CR_DBP;
+	BKP_DR1 = CONFIG_MODE_REQUEST;
+
+	SCB_AIRCR = SCB_AIRCR_VECTKEY | SCB_AIRCR_SYSRESETREQ;
+	while (1);
+}
+
 /*
  * The function responsible for printing the current status onto the
  * screen.
@@ -266,6 +303,68 @@ void console_run() {
 	}
 }
 
+/*
+ * Prints one line of the bus statistics.
+ */
+static void show_stat(const char *name, uint32_t value) {
+	console_write(name);
+	console_uint(value, 10, 10, ' ');
+	console_write(CRLF);
+}
+
+/*
+ * Prints the counters of the bus traffic and of the color cache
+ * since startup.
+ */
+static void show_bus_stats() {
+	usart_stats_t stats;
+	usart2_get_stats(&stats);
+
+	console_write("Bus statistics since startup:" CRLF);
+	show_stat("Bytes received:  ", stats.bytes);
+	show_stat("Frames:          ", stats.frames);
+	show_stat("Frames for us:   ", stats.frames_accepted);
+	show_stat("Strobes:         ", command_strobe_count());
+	show_stat("Framing errors:  ", stats.framing_errors);
+	show_stat("Noise errors:    ", stats.noise_errors);
+	show_stat("Overrun errors:  ", stats.overrun_errors);
+	show_stat("Overflows:       ", stats.overflows);
+	show_stat("Dropped bytes:   ", stats.dropped_bytes);
+	show_stat("Max backlog:     ", stats.max_backlog);
+	show_stat("Receive ring:    ", USART_RX_RING_LEN);
+	show_stat("Dropped commands:", stats.dropped_commands);
+	show_stat("Max queued:      ", stats.max_queued);
+
+	uint32_t hits, misses;
+	command_xyY_cache_stats(&hits, &misses);
+	show_stat("xyY cache hits:  ", hits);
+	show_stat("xyY cache misses:", misses);
+}
+
+/*
+ * Handles keys pressed on the console in normal mode. This does not
+ * block, so it can be called from the main loop.
+ */
+void console_poll() {
+	if (!usart1_has_input()) {
+		return;
+	}
+
+	switch (usart1_getchar()) {
+	case 's':
+		show_bus_stats();
+		break;
+#ifdef TRACE_CYCLES
+	case 't':
+		trace_dump();
+		break;
+#endif
+	default:
+		// Nothing else to do in normal mode.
+		break;
+	}
+}
+
 /*
  * The following functions are not used by the console itself, but are
  * shared between the operating modes.
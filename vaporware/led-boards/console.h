@@ -7,6 +7,8 @@
  * (debug or config) and a configuration shell.
  */
 
+#include <stdbool.h>
+
 #include "error.h"
 #include "fixedpoint.h"
 #include "command.h"
@@ -105,6 +107,18 @@ void console_getline(char *buffer, int count);
  */
 vl_mode_t console_ask_mode();
 
+/*
+ * Returns whether config mode was requested for this boot, with
+ * console_request_config_mode or the strap on the console RX line.
+ */
+bool console_config_requested();
+
+/*
+ * Resets the board and makes it start in config mode. This function
+ * does not return.
+ */
+void console_request_config_mode();
+
 /*
  * Runs the configuration console. This function may or may not
  * return, depending on whether the user chose to continue running or
@@ -112,6 +126,12 @@ vl_mode_t console_ask_mode();
  */
 void console_run();
 
+/*
+ * Handles keys pressed on the console in normal mode. This does not
+ * block, so it can be called from the main loop.
+ */
+void console_poll();
+
 /*
  * Parses the integer beginning at position *pos in line. After
  * parsing, *pos is updated to point to the first character after the
@@ -8,8 +8,10 @@
 #include "error.h"
 #include "fixedpoint.h"
 #include "git_version.h"
+#include "heat.h"
 #include "pwm.h"
 #include "term.h"
+#include "trace.h"
 
 #include "stm_include/stm32/scb.h"
 
@@ -56,6 +58,9 @@ static const char *SENSOR_OUT_OF_RANGE =
 static const char *HEAT_LIMIT_OUT_OF_RANGE =
 	"Heat limit out of range (0 to 0xffff)" CRLF;
 
+static const char *CHANNEL_MASK_OUT_OF_RANGE =
+	"Channel mask out of range (0 to 0xffff)" CRLF;
+
 static const char *NO_CONFIG_FOUND =
 	"No configuration in flash" CRLF;
 
@@ -86,6 +91,9 @@ static const char *ENTER_MATRIX =
 static const char *ENTER_MAX_Y =
 	"Enter maximum Y value" CRLF;
 
+static const char *ENTER_GAMMA =
+	"Enter " XSTR(GAMMA_POINTS) " PWM values for 0 to 255 in equal steps" CRLF;
+
 /*
  * Checks that the given value is greater than or equal to 0 and less
  * then the given limit. Prints the given message and returns
@@ -279,6 +287,22 @@ static error_t run_echo(unsigned int args[]) {
 	return E_SUCCESS;
 }
 
+#ifdef TRACE_CYCLES
+/*
+ * Runs the "dump cycle trace" command.
+ *
+ * Expected format for args: { }
+ *
+ * Always succeeds.
+ */
+static error_t run_dump_trace(unsigned int args[]) {
+	(void)args;
+	trace_dump();
+
+	return E_SUCCESS;
+}
+#endif
+
 /*
  * Runs the "paste command file" command.
  *
@@ -321,6 +345,70 @@ static error_t run_set_heat_limit(unsigned int args[]) {
 	return E_SUCCESS;
 }
 
+/*
+ * Runs the "set heat sensor channels" command.
+ *
+ * Expected format for args: { sensor-index, channel-mask }
+ *
+ * Returns E_ARG_FORMAT if the heat sensor index or the mask is out of range.
+ */
+static error_t run_set_heat_channels(unsigned int args[]) {
+	int index = args[0];
+	int mask = args[1];
+
+	if (check_range(index, HEAT_SENSOR_LEN, SENSOR_OUT_OF_RANGE)) {
+		return E_ARG_FORMAT;
+	}
+	if (check_short(mask, CHANNEL_MASK_OUT_OF_RANGE)) {
+		return E_ARG_FORMAT;
+	}
+
+	config.heat_channels[index] = mask;
+	return E_SUCCESS;
+}
+
+/*
+ * Runs the "set dithered channels" command.
+ *
+ * Expected format for args: { channel-mask }
+ *
+ * Returns E_ARG_FORMAT if the mask is out of range. Also passes on the
+ * errors from pwm_send_frame.
+ */
+static error_t run_set_dither_channels(unsigned int args[]) {
+	int mask = args[0];
+
+	if (check_short(mask, CHANNEL_MASK_OUT_OF_RANGE)) {
+		return E_ARG_FORMAT;
+	}
+
+	config.dither_channels = mask;
+
+	// Show the current values with the new setting.
+	return pwm_send_frame();
+}
+
+/*
+ * Runs the "set end aligned channels" command.
+ *
+ * Expected format for args: { channel-mask }
+ *
+ * Returns E_ARG_FORMAT if the mask is out of range. Also passes on the
+ * errors from pwm_send_frame.
+ */
+static error_t run_set_end_aligned_channels(unsigned int args[]) {
+	int mask = args[0];
+
+	if (check_short(mask, CHANNEL_MASK_OUT_OF_RANGE)) {
+		return E_ARG_FORMAT;
+	}
+
+	config.end_aligned_channels = mask;
+
+	// Show the current values with the new setting.
+	return pwm_send_frame();
+}
+
 /*
  * Runs the "reload configuration from flash" command.
  *
@@ -482,6 +570,34 @@ static error_t run_set_max_Y(unsigned int args[]) {
 	return E_SUCCESS;
 }
 
+/*
+ * Runs the "set gamma curve" command.
+ *
+ * Expected format for args: { }
+ *
+ * Returns E_ARG_FORMAT if a value is out of range.
+ */
+static error_t run_set_gamma(unsigned int args[]) {
+	(void)args;
+	uint16_t gamma[GAMMA_POINTS];
+
+	console_write(ENTER_GAMMA);
+
+	for (int i = 0; i < GAMMA_POINTS; i++) {
+		int input = console_ask_int("", 16);
+		if (check_short(input, BRIGHTNESS_OUT_OF_RANGE)) {
+			return E_ARG_FORMAT;
+		}
+		gamma[i] = input;
+	}
+
+	for (int i = 0; i < GAMMA_POINTS; i++) {
+		config.gamma[i] = gamma[i];
+	}
+
+	return E_SUCCESS;
+}
+
 /*
  * This is actually implemented after the command array, because it
  * needs access to it.
@@ -518,6 +634,13 @@ static console_command_t commands[] = {
 		.usage = "C <led>: Set calibration of LED",
 		.does_exit = 0,
 	},
+	{
+		.key = 'd',
+		.arg_length = 1,
+		.handler = run_set_dither_channels,
+		.usage = "d <channel-mask>: Set PWM channels dithered between PWM steps",
+		.does_exit = 0,
+	},
 	{
 		.key = 'e',
 		.arg_length = 0,
@@ -532,6 +655,13 @@ static console_command_t commands[] = {
 		.usage = "f: Paste a command file",
 		.does_exit = 0,
 	},
+	{
+		.key = 'g',
+		.arg_length = 0,
+		.handler = run_set_gamma,
+		.usage = "g: Set gamma curve for 8 bit values",
+		.does_exit = 0,
+	},
 	{
 		.key = 'h',
 		.arg_length = 2,
@@ -539,6 +669,13 @@ static console_command_t commands[] = {
 		.usage = "h <sensor> <heat-limit>: Set heat limit",
 		.does_exit = 0,
 	},
+	{
+		.key = 'H',
+		.arg_length = 2,
+		.handler = run_set_heat_channels,
+		.usage = "H <sensor> <channel-mask>: Set PWM channels dimmed by a heat sensor",
+		.does_exit = 0,
+	},
 	{
 		.key = 'l',
 		.arg_length = 0,
@@ -560,6 +697,13 @@ static console_command_t commands[] = {
 		.usage = "p <led> <r-chan> <g-chan> <b-chan>: set an LED's PWM channels",
 		.does_exit = 0,
 	},
+	{
+		.key = 'P',
+		.arg_length = 1,
+		.handler = run_set_end_aligned_channels,
+		.usage = "P <channel-mask>: Set PWM channels pulsed at the end of the period",
+		.does_exit = 0,
+	},
 	{
 		.key = 'q',
 		.arg_length = 0,
@@ -581,6 +725,15 @@ static console_command_t commands[] = {
 		.usage = "s: Save configuration",
 		.does_exit = 0,
 	},
+#ifdef TRACE_CYCLES
+	{
+		.key = 't',
+		.arg_length = 0,
+		.handler = run_dump_trace,
+		.usage = "t: Dump the cycle trace",
+		.does_exit = 0,
+	},
+#endif
 	{
 		.key = 'y',
 		.arg_length = 1,
@@ -627,9 +780,15 @@ static const char *MODULE_ADDRESS =
 static const char *IS_BROADCAST =
 	" (broadcast)";
 
+static const char *DITHER_CHANNELS =
+	"Dithered PWM channels: ";
+
+static const char *END_ALIGNED_CHANNELS =
+	"End aligned PWM channels: ";
+
 static const char *HEAT_SETTINGS_HEAD =
 	"Heat sensor settings:" CRLF
-        "Sensor  Limit" CRLF;
+        "Sensor  Limit  Channels  Now    Output" CRLF;
 
 static const char *LED_SETTINGS_HEAD =
 	"LED settings:" CRLF
@@ -648,15 +807,17 @@ void show_status_prompt() {
 /*
 vaporlight build 0000000000000000000000000000000000000000
 This is module 99
+Dithered PWM channels: ffff
+End aligned PWM channels: ffff
 
 Heat sensor settings:
-Sensor   Limit
-    99   9999
-    99   9999
-    99   9999
-    99   9999
-    99   9999
-    99   9999
+Sensor  Limit  Channels  Now    Output
+    99  99999  ffff      99999  100%
+    99  99999  ffff      99999  100%
+    99  99999  ffff      99999  100%
+    99  99999  ffff      99999  100%
+    99  99999  ffff      99999  100%
+    99  99999  ffff      99999  100%
 
 LED settings:
 LED  channel  correction matrix           Y_max
@@ -686,6 +847,14 @@ LED  channel  correction matrix           Y_max
 	if (config.my_address == 0xfd) {
 		console_write(IS_BROADCAST);
 	}
+	console_write(CRLF);
+
+	console_write(DITHER_CHANNELS);
+	console_uint_04x(config.dither_channels);
+	console_write(CRLF);
+
+	console_write(END_ALIGNED_CHANNELS);
+	console_uint_04x(config.end_aligned_channels);
 	console_write(CRLF CRLF);
 
 	console_write(HEAT_SETTINGS_HEAD);
@@ -695,7 +864,13 @@ LED  channel  correction matrix           Y_max
 		console_uint_2d(i);
 		console_write("   ");
 		console_uint_5d(config.heat_limit[i]);
-		console_write(CRLF);
+		console_write("  ");
+		console_uint_04x(config.heat_channels[i]);
+		console_write("      ");
+		console_uint_5d(heat_temperature(i));
+		console_write("  ");
+		console_uint_3d(heat_output_percent(i));
+		console_write("%" CRLF);
 	}
 	console_write(CRLF);
 
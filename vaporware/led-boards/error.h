@@ -37,7 +37,7 @@ typedef enum {
 	ER_USART_RX    = 0b01011101000111010101110000000000,
 	// "FW" An error ocurred while writing to flash.
 	ER_FLASH_WRITE = 0b01010111010001011101110000000000,
-	// "CO" Too many commands are queued in the USART buffers
+	// "CO" The USART receive buffer overflowed
 	ER_CMDOVERFLOW = 0b01110101110100011101110111000000
 } err_reason_t;
 
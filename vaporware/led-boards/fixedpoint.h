@@ -25,58 +25,124 @@ typedef struct {
 #define FIXINIT(f) {((((int)(f)) << 16) + (int)((f - (int)(f)) * (1 << FRAC_BITS)))}
 #define FIXNUM(f) ((fixed_t) FIXINIT(f))
 
+/*
+ * All operations except fixdiv are defined here, so that they are
+ * inlined in every build, with or without -flto.
+ */
+
 /*
  * Returns a fixed point number with the value n.
  */
-fixed_t fixnum(int16_t n);
+static inline fixed_t fixnum(int16_t n) {
+	return (fixed_t) { n << FRAC_BITS };
+}
 
 /*
  * Returns a fixed point number with the value n/65536.
  */
-fixed_t fixfract(uint16_t n);
+static inline fixed_t fixfract(uint16_t n) {
+	return (fixed_t) { n };
+}
 
 /*
  * Returns the integral part of f.
  */
-int16_t fix_int_part(fixed_t f);
+static inline int16_t fix_int_part(fixed_t f) {
+	return (int16_t)(f.v >> FRAC_BITS);
+}
 
 /*
  * Returns the fractional part of f.
  */
-uint16_t fix_fract_part(fixed_t f);
+static inline uint16_t fix_fract_part(fixed_t f) {
+	return (uint16_t)(f.v);
+}
 
 /*
  * Basic arithmetic operations on fixed point numbers.
+ *
+ * The product is truncated (rounded towards negative infinity). The
+ * 32x32->64 bit multiplication compiles to a single SMULL.
  */
-fixed_t fixadd(fixed_t f, fixed_t g);
-fixed_t fixsub(fixed_t f, fixed_t g);
-fixed_t fixmul(fixed_t f, fixed_t g);
+static inline fixed_t fixadd(fixed_t f, fixed_t g) {
+	return (fixed_t) { f.v + g.v };
+}
+
+static inline fixed_t fixsub(fixed_t f, fixed_t g) {
+	return (fixed_t) { f.v - g.v };
+}
+
+static inline fixed_t fixmul(fixed_t f, fixed_t g) {
+	return (fixed_t) { ((int64_t) f.v * g.v) >> FRAC_BITS };
+}
+
 fixed_t fixdiv(fixed_t f, fixed_t g);
 
 /*
  * Unary negation
  */
-fixed_t fixneg(fixed_t f);
+static inline fixed_t fixneg(fixed_t f) {
+	return (fixed_t) { -f.v };
+}
 
 /*
  * Convenience functions for longer sums and products.
  */
-fixed_t fixadd3(fixed_t f, fixed_t g, fixed_t h);
+static inline fixed_t fixadd3(fixed_t f, fixed_t g, fixed_t h) {
+	return (fixed_t) { f.v + g.v + h.v };
+}
+
+/*
+ * Returns the dot product of a and b.
+ *
+ * The products are summed with full precision (one SMULL and two
+ * SMLALs) and only the sum is truncated, so this can be up to 2/65536
+ * larger than adding up three fixmuls. The sum of the products must
+ * fit into 64 bits, which it does unless they are all close to 2^62.
+ */
+static inline fixed_t fixdot3(const fixed_t a[static 3], const fixed_t b[static 3]) {
+	int64_t sum = (int64_t) a[0].v * b[0].v;
+	sum += (int64_t) a[1].v * b[1].v;
+	sum += (int64_t) a[2].v * b[2].v;
+	return (fixed_t) { sum >> FRAC_BITS };
+}
 
 /*
  * Relational operators.
  */
-bool fixlt(fixed_t f, fixed_t g);
-bool fixgt(fixed_t f, fixed_t g);
-bool fixle(fixed_t f, fixed_t g);
-bool fixge(fixed_t f, fixed_t g);
-bool fixeq(fixed_t f, fixed_t g);
-bool fixne(fixed_t f, fixed_t g);
+static inline bool fixlt(fixed_t f, fixed_t g) {
+	return f.v < g.v;
+}
+
+static inline bool fixgt(fixed_t f, fixed_t g) {
+	return f.v > g.v;
+}
+
+static inline bool fixle(fixed_t f, fixed_t g) {
+	return f.v <= g.v;
+}
+
+static inline bool fixge(fixed_t f, fixed_t g) {
+	return f.v >= g.v;
+}
+
+static inline bool fixeq(fixed_t f, fixed_t g) {
+	return f.v == g.v;
+}
+
+static inline bool fixne(fixed_t f, fixed_t g) {
+	return f.v != g.v;
+}
 
 /*
  * Return minimum and maximum.
  */
-fixed_t fixmin(fixed_t f, fixed_t g);
-fixed_t fixmax(fixed_t f, fixed_t g);
+static inline fixed_t fixmin(fixed_t f, fixed_t g) {
+	return fixlt(f, g) ? f : g;
+}
+
+static inline fixed_t fixmax(fixed_t f, fixed_t g) {
+	return fixgt(f, g) ? f : g;
+}
 
 #endif
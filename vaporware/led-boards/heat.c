@@ -1,64 +1,36 @@
 #include "heat.h"
 
 #include "config.h"
+#include "console.h"
 #include "error.h"
 #include "fail.h"
-
-#include "stm_include/stm32/adc.h"
-#include "stm_include/stm32/dma.h"
-#include "stm_include/stm32/nvic.h"
-#include "stm_include/stm32/systick.h"
+#include "heat_hal.h"
+#include "pwm.h"
+#include "term.h"
 
 /*
  * The function to be called when overheat occurs.
  */
 static heat_handler_t overheat_handler;
 
-/*
- * The samples got from the ADC will be writter here by DMA.
- */
-static int adc_samples[HEAT_SENSOR_LEN];
-
 /*
  * The failure logs for each heat sensor
  */
 static fail_t heat_fails[HEAT_SENSOR_LEN];
 
 /*
- * Returns the sequence register where the n'th conversion
- * is to be stored. If n = 17, the sequence length field is returned.
+ * The filtered temperatures of the sensors, times 2^HEAT_FILTER_SHIFT.
  */
-static volatile uint32_t *seq_register_for(unsigned int n) {
-	if (n > 17) {
-		error(ER_BUG, STR_WITH_LEN("ADC sequence too long"), EA_PANIC);
-	}
-
-	if (n <= 6) {
-		return &ADC1_SQR3;
-	} else if (n <= 12) {
-		return &ADC1_SQR2;
-	} else {
-		return &ADC1_SQR1;
-	}
-}
+static uint32_t filtered[HEAT_SENSOR_LEN];
+static bool filter_started = false;
 
 /*
- * Returns the bit position in the sequence register where
- * the n'th conversion is to be stored. If n = 17 the position
- * of the sequence length field is returned.
+ * The factor each sensor dims the channels near it with, in
+ * 1/PWM_FULL_OUTPUT.
  */
-static int bit_position_for(unsigned int n) {
-	if (n > 17) {
-		error(ER_BUG, STR_WITH_LEN("ADC sequence too long"), EA_PANIC);
-	}
-
-	// Each register contains the following conversions (for one k)
-	// 6k + 1 at bits  4 to  0
-	// ...
-	// 6k + 6 at bits 29 to 25
-	// This formula follows:
-	return ((n-1) % 6) * 5;
-}
+static uint32_t derating[HEAT_SENSOR_LEN] = {
+	[0 ... HEAT_SENSOR_LEN - 1] = PWM_FULL_OUTPUT
+};
 
 /*
  * Initializes temperature sensors. When this function has been called,
@@ -71,57 +43,107 @@ void heat_init(heat_handler_t on_overheat) {
 		fail_init(&heat_fails[s], HEAT_FAIL_TRESHOLD);
 	}
 
-	// Configure the ADC in the following way:
-	// Put the values from HEAT_ADC_PORTS into the sequence registers
-	// Start ADC in scan mode with continuous bit set.
-	// Configure DMA to write samples to adc_samples.
+	heat_hal_init();
+}
+
+/*
+ * Returns the factor a sensor with the given temperature and heat
+ * limit dims its channels with, without hysteresis.
+ */
+static uint32_t derating_for(uint32_t temperature, uint16_t limit) {
+	uint32_t start = limit > HEAT_DERATE_RANGE ? limit - HEAT_DERATE_RANGE : 0;
+
+	if (temperature <= start) {
+		return PWM_FULL_OUTPUT;
+	} else if (temperature >= limit) {
+		return HEAT_DERATE_MIN;
+	} else {
+		return PWM_FULL_OUTPUT - (temperature - start) *
+			(PWM_FULL_OUTPUT - HEAT_DERATE_MIN) / (limit - start);
+	}
+}
+
+/*
+ * Updates the derating of the given sensor from its filtered
+ * temperature. The channels are dimmed as soon as it gets hotter, but
+ * only brightened again when it has cooled down by
+ * HEAT_DERATE_HYSTERESIS. Changes are reported on the console.
+ */
+static void update_derating(int sensor) {
+	uint32_t temperature = filtered[sensor] >> HEAT_FILTER_SHIFT;
+	uint16_t limit = config.heat_limit[sensor];
+
+	uint32_t down = derating_for(temperature, limit);
+	uint32_t up = derating_for(temperature + HEAT_DERATE_HYSTERESIS, limit);
+	uint32_t old = derating[sensor];
+
+	if (down < derating[sensor]) {
+		derating[sensor] = down;
+	} else if (up > derating[sensor]) {
+		derating[sensor] = up;
+	}
 
-	// Write ADC ports into sequence registers.
-	_Static_assert(HEAT_SENSOR_LEN <= 16, "Too many heat sensors!");
-	for (int i = 0; i < HEAT_SENSOR_LEN; i++) {
-		*seq_register_for(i) = (HEAT_ADC_PORTS[i] & 0xf) << bit_position_for(i);
+	if (heat_output_percent(sensor) != old * 100 / PWM_FULL_OUTPUT) {
+		console_write("Heat sensor ");
+		console_uint_d(sensor);
+		console_write(": output limited to ");
+		console_uint_d(heat_output_percent(sensor));
+		console_write("%" CRLF);
 	}
-	// Write length into sequence length field.
-	*seq_register_for(17) = HEAT_SENSOR_LEN << bit_position_for(17);
-
-	// Set up ADC
-	ADC1_CR1 = ADC_CR1_SCAN | // Scan mode
-		ADC_CR1_EOCIE;    // End of conversion interrupt enable
-	ADC1_CR2 = ADC_CR2_CONT | // Continuous mode.
-		ADC_CR2_DMA;      // DMA mode
-	ADC1_SMPR1 = ADC_SAMPLE_TIME_1;
-	ADC1_SMPR2 = ADC_SAMPLE_TIME_2;
-	
-
-	// Set up DMA (using channel 1 of DMA 1 here)
-	DMA1_CPAR1 = (uint32_t) &ADC1_DR;
-	DMA1_CMAR1 = (uint32_t) &adc_samples;
-	DMA1_CNDTR1 = HEAT_SENSOR_LEN;
-	DMA1_CCR1 = (DMA_CCR1_PL_HIGH << DMA_CCR1_PL_LSB) |    // High priority
-		(DMA_CCR1_MSIZE_16BIT << DMA_CCR1_MSIZE_LSB) | // 16 bit memory size
-		(DMA_CCR1_PSIZE_16BIT << DMA_CCR1_PSIZE_LSB) | // 16 bit peripheral size
-		DMA_CCR1_MINC |                                // Memory auto-increment
-		DMA_CCR1_CIRC |                                // Circular mode
-		DMA_CCR1_EN;                                   // enable
-
-	// Enable ADC interrupt in NVIC
-	NVIC_ISER(0) |= (1 << NVIC_ADC1_2_IRQ);
-
-	ADC1_CR2 |= ADC_CR2_ADON;
-
-	// Enable Systick timer, enable interrupt.
-	// (heat_timer_tick will be called at each systick)
-	STK_CTRL = STK_CTRL_TICKINT | STK_CTRL_ENABLE;
+}
+
+/*
+ * Returns the average of the last samples of the given sensor.
+ */
+uint16_t heat_temperature(int sensor) {
+	return heat_hal_sample(sensor);
+}
+
+/*
+ * Returns the output the given sensor limits its channels to, in
+ * percent.
+ */
+unsigned int heat_output_percent(int sensor) {
+	return derating[sensor] * 100 / PWM_FULL_OUTPUT;
 }
 
 /*
  * This function does a heat check on every system timer tick.
+ *
+ * The temperatures are filtered to dim the channels near hot sensors.
+ * If a sensor still stays above its limit, the overheat handler is
+ * called.
  */
 void heat_timer_tick() {
+	uint32_t factors[MODULE_LENGTH];
+
+	for (int c = 0; c < MODULE_LENGTH; c++) {
+		factors[c] = PWM_FULL_OUTPUT;
+	}
+
 	for (int s = 0; s < HEAT_SENSOR_LEN; s++) {
-		if (fail_event(&heat_fails[s], (adc_samples[s] > config.heat_limit[s]))) {
+		uint16_t temperature = heat_hal_sample(s);
+
+		if (fail_event(&heat_fails[s], (temperature > config.heat_limit[s]))) {
 			overheat_handler();
 			return;
 		}
+
+		if (filter_started) {
+			filtered[s] += temperature - (filtered[s] >> HEAT_FILTER_SHIFT);
+		} else {
+			filtered[s] = (uint32_t) temperature << HEAT_FILTER_SHIFT;
+		}
+
+		update_derating(s);
+
+		for (int c = 0; c < MODULE_LENGTH; c++) {
+			if ((config.heat_channels[s] & (1 << c)) && derating[s] < factors[c]) {
+				factors[c] = derating[s];
+			}
+		}
 	}
+	filter_started = true;
+
+	pwm_set_derating(factors);
 }
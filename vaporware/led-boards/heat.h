@@ -1,6 +1,8 @@
 #ifndef HEAT_H
 #define HEAT_H
 
+#include <stdint.h>
+
 /*
  * The type for overheat handler functions.
  */
@@ -15,8 +17,23 @@ void heat_init(heat_handler_t on_overheat);
 
 /*
  * This function does a heat check on every system timer tick.
+ *
+ * When a sensor gets close to its heat limit, the PWM channels near it
+ * are dimmed. The overheat handler is only called if it still stays
+ * above the limit.
  */
 void heat_timer_tick();
 
+/*
+ * Returns the current reading of the given heat sensor.
+ */
+uint16_t heat_temperature(int sensor);
+
+/*
+ * Returns the output the given heat sensor limits the channels near it
+ * to, in percent.
+ */
+unsigned int heat_output_percent(int sensor);
+
 
 #endif
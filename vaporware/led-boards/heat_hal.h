@@ -0,0 +1,25 @@
+#ifndef HEAT_HAL_H
+#define HEAT_HAL_H
+
+/*
+ * The hardware side of the heat check: the ADC that samples the heat
+ * sensors. The filtering and derating in heat.c only go through these
+ * functions. A host build provides its own version of them (see
+ * host/).
+ */
+
+#include <stdint.h>
+
+/*
+ * Starts sampling the heat sensors, and the systick, which triggers
+ * the heat checks.
+ */
+void heat_hal_init();
+
+/*
+ * Returns the average of the last HEAT_OVERSAMPLING samples of the
+ * given sensor.
+ */
+uint16_t heat_hal_sample(int sensor);
+
+#endif
@@ -0,0 +1,108 @@
+/*
+ * Pins the results of color_correct for a grid of colors, for the
+ * sRGB example LED of the default configuration and for one with
+ * different peak luminosities. The expected values were computed with
+ * the matrix products summed by fixdot3, so any change to the color
+ * math that changes a PWM value shows up here.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "color.h"
+#include "config.h"
+
+typedef struct {
+	int led;
+	uint16_t x, y, Y;
+	uint16_t rgb[3];
+} color_case_t;
+
+static const color_case_t cases[] = {
+	{ 0, 0x4000, 0x3000, 0x0000, { 0x0000, 0x0000, 0x0000 } },
+	{ 0, 0x4000, 0x3000, 0x0001, { 0x000a, 0x000a, 0x002c } },
+	{ 0, 0x4000, 0x3000, 0x00fa, { 0x09f5, 0x0a21, 0x2be8 } },
+	{ 0, 0x4000, 0x3000, 0x03e7, { 0x27cc, 0x287b, 0xaf75 } },
+	{ 0, 0x4000, 0x3000, 0x8000, { 0x3a11, 0x3b11, 0xffff } },
+	{ 0, 0x4000, 0x5000, 0x0000, { 0x0000, 0x0000, 0x0000 } },
+	{ 0, 0x4000, 0x5000, 0x0001, { 0x0004, 0x001c, 0x0020 } },
+	{ 0, 0x4000, 0x5000, 0x00fa, { 0x049b, 0x1b9f, 0x1fc5 } },
+	{ 0, 0x4000, 0x5000, 0x03e7, { 0x1267, 0x6e62, 0x7ef4 } },
+	{ 0, 0x4000, 0x5000, 0x8000, { 0x251c, 0xde94, 0xffff } },
+	{ 0, 0x5000, 0x3000, 0x0000, { 0x0000, 0x0000, 0x0000 } },
+	{ 0, 0x5000, 0x3000, 0x0001, { 0x0014, 0x0005, 0x0028 } },
+	{ 0, 0x5000, 0x3000, 0x00fa, { 0x1399, 0x054f, 0x2716 } },
+	{ 0, 0x5000, 0x3000, 0x03e7, { 0x4e51, 0x1539, 0x9c33 } },
+	{ 0, 0x5000, 0x3000, 0x8000, { 0x805a, 0x22c9, 0xffff } },
+	{ 0, 0x5000, 0x5000, 0x0000, { 0x0000, 0x0000, 0x0000 } },
+	{ 0, 0x5000, 0x5000, 0x0001, { 0x000e, 0x0017, 0x001b } },
+	{ 0, 0x5000, 0x5000, 0x00fa, { 0x0e3e, 0x16cd, 0x1af3 } },
+	{ 0, 0x5000, 0x5000, 0x03e7, { 0x38eb, 0x5b20, 0x6bb2 } },
+	{ 0, 0x5000, 0x5000, 0x8000, { 0x874c, 0xd89a, 0xffff } },
+	{ 0, 0x5555, 0x3000, 0x0000, { 0x0000, 0x0000, 0x0000 } },
+	{ 0, 0x5555, 0x3000, 0x0001, { 0x0017, 0x0003, 0x0026 } },
+	{ 0, 0x5555, 0x3000, 0x00fa, { 0x16cf, 0x03b4, 0x257b } },
+	{ 0, 0x5555, 0x3000, 0x03e7, { 0x5b27, 0x0ece, 0x95c8 } },
+	{ 0, 0x5555, 0x3000, 0x8000, { 0x9bcb, 0x194e, 0xffff } },
+	{ 0, 0x5555, 0x5000, 0x0000, { 0x0000, 0x0000, 0x0000 } },
+	{ 0, 0x5555, 0x5000, 0x0001, { 0x0011, 0x0015, 0x0019 } },
+	{ 0, 0x5555, 0x5000, 0x00fa, { 0x1174, 0x1532, 0x1958 } },
+	{ 0, 0x5555, 0x5000, 0x03e7, { 0x45c1, 0x54b4, 0x6548 } },
+	{ 0, 0x5555, 0x5000, 0x8000, { 0xb04f, 0xd619, 0xffff } },
+	{ 1, 0x4000, 0x3000, 0x0000, { 0x0000, 0x0000, 0x0000 } },
+	{ 1, 0x4000, 0x3000, 0x0001, { 0x0025, 0x0026, 0x00a5 } },
+	{ 1, 0x4000, 0x3000, 0x00fa, { 0x24b0, 0x2551, 0xa1bc } },
+	{ 1, 0x4000, 0x3000, 0x03e7, { 0x3a11, 0x3b11, 0xffff } },
+	{ 1, 0x4000, 0x3000, 0x8000, { 0x3a11, 0x3b11, 0xffff } },
+	{ 1, 0x4000, 0x5000, 0x0000, { 0x0000, 0x0000, 0x0000 } },
+	{ 1, 0x4000, 0x5000, 0x0001, { 0x000a, 0x003c, 0x0045 } },
+	{ 1, 0x4000, 0x5000, 0x00fa, { 0x09ce, 0x3ad2, 0x43a7 } },
+	{ 1, 0x4000, 0x5000, 0x03e7, { 0x251c, 0xde94, 0xffff } },
+	{ 1, 0x4000, 0x5000, 0x8000, { 0x251c, 0xde94, 0xffff } },
+	{ 1, 0x5000, 0x3000, 0x0000, { 0x0000, 0x0000, 0x0000 } },
+	{ 1, 0x5000, 0x3000, 0x0001, { 0x0053, 0x0016, 0x00a6 } },
+	{ 1, 0x5000, 0x3000, 0x00fa, { 0x51b5, 0x1625, 0xa2f8 } },
+	{ 1, 0x5000, 0x3000, 0x03e7, { 0x805a, 0x22c9, 0xffff } },
+	{ 1, 0x5000, 0x3000, 0x8000, { 0x805a, 0x22c9, 0xffff } },
+	{ 1, 0x5000, 0x5000, 0x0000, { 0x0000, 0x0000, 0x0000 } },
+	{ 1, 0x5000, 0x5000, 0x0001, { 0x0021, 0x0035, 0x003f } },
+	{ 1, 0x5000, 0x5000, 0x00fa, { 0x2085, 0x3410, 0x3d89 } },
+	{ 1, 0x5000, 0x5000, 0x03e7, { 0x81f5, 0xd00d, 0xf5e4 } },
+	{ 1, 0x5000, 0x5000, 0x8000, { 0x874c, 0xd89a, 0xffff } },
+	{ 1, 0x5555, 0x3000, 0x0000, { 0x0000, 0x0000, 0x0000 } },
+	{ 1, 0x5555, 0x3000, 0x0001, { 0x0065, 0x0010, 0x00a7 } },
+	{ 1, 0x5555, 0x3000, 0x00fa, { 0x6379, 0x1028, 0xa375 } },
+	{ 1, 0x5555, 0x3000, 0x03e7, { 0x9bcb, 0x194e, 0xffff } },
+	{ 1, 0x5555, 0x3000, 0x8000, { 0x9bcb, 0x194e, 0xffff } },
+	{ 1, 0x5555, 0x5000, 0x0000, { 0x0000, 0x0000, 0x0000 } },
+	{ 1, 0x5555, 0x5000, 0x0001, { 0x0029, 0x0032, 0x003c } },
+	{ 1, 0x5555, 0x5000, 0x00fa, { 0x28d6, 0x3197, 0x3b4c } },
+	{ 1, 0x5555, 0x5000, 0x03e7, { 0xa331, 0xc62b, 0xecf3 } },
+	{ 1, 0x5555, 0x5000, 0x8000, { 0xb04f, 0xd619, 0xffff } },
+};
+
+int main() {
+	led_info_t infos[2] = { config.led_infos[0], config.led_infos[0] };
+	infos[1].peak_Y[0] = FIXNUM(300);
+	infos[1].peak_Y[1] = FIXNUM(900);
+	infos[1].peak_Y[2] = FIXNUM(120);
+
+	unsigned failures = 0;
+	const unsigned count = sizeof(cases) / sizeof(cases[0]);
+
+	for (unsigned i = 0; i < count; i++) {
+		const color_case_t *c = &cases[i];
+		uint16_t rgb[3];
+		color_correct(infos[c->led], c->x, c->y, c->Y, rgb);
+
+		if (rgb[0] != c->rgb[0] || rgb[1] != c->rgb[1] || rgb[2] != c->rgb[2]) {
+			failures++;
+			printf("LED %d, xyY %04x %04x %04x: got %04x %04x %04x, expected %04x %04x %04x\n",
+			       c->led, c->x, c->y, c->Y, rgb[0], rgb[1], rgb[2],
+			       c->rgb[0], c->rgb[1], c->rgb[2]);
+		}
+	}
+
+	printf("color: %u cases, %u failures\n", count, failures);
+	return failures != 0;
+}
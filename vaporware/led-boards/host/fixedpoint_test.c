@@ -0,0 +1,165 @@
+/*
+ * Checks the fixed point operations in fixedpoint.h against reference
+ * implementations that compute the exact result with 128 bit integers.
+ *
+ * The operands are random, with random magnitudes so that small
+ * values and the edges of the range are covered as well. Operations
+ * whose exact result doesn't fit into a fixed_t are skipped; the
+ * firmware never relies on their overflow.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "fixedpoint.h"
+
+#define ROUNDS 1000000
+
+typedef __int128 wide_t;
+
+static unsigned long checks = 0;
+static unsigned long failures = 0;
+
+/*
+ * xorshift64, so that the test does the same on every run.
+ */
+static uint64_t random_state = 0x9e3779b97f4a7c15ull;
+
+static uint64_t random64() {
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 7;
+	random_state ^= random_state << 17;
+	return random_state;
+}
+
+/*
+ * Returns a random fixed_t of random magnitude.
+ */
+static fixed_t random_fixed() {
+	uint64_t r = random64();
+	int bits = r % 33;
+	int32_t v = (int32_t) (r >> 32);
+
+	if (bits < 32) {
+		v = (int32_t) ((uint32_t) v & ((1u << bits) - 1));
+		if (r & 0x100) {
+			v = -v;
+		}
+	}
+	return (fixed_t) { v };
+}
+
+static bool fits(wide_t v) {
+	return v >= INT32_MIN && v <= INT32_MAX;
+}
+
+/*
+ * Division rounding towards negative infinity.
+ */
+static wide_t floor_div(wide_t a, wide_t b) {
+	wide_t q = a / b;
+	if (a % b != 0 && (a < 0) != (b < 0)) {
+		q--;
+	}
+	return q;
+}
+
+static void check(bool ok, const char *op, long long a, long long b, long long got) {
+	checks++;
+	if (!ok) {
+		failures++;
+		if (failures <= 20) {
+			printf("%s(%lld, %lld) = %lld is wrong\n", op, a, b, got);
+		}
+	}
+}
+
+static void check_unary(fixed_t f, int16_t n, uint16_t u) {
+	check(fixnum(n).v == (wide_t) n * 65536, "fixnum", n, 0, fixnum(n).v);
+	check(fixfract(u).v == u, "fixfract", u, 0, fixfract(u).v);
+	check(fix_int_part(f) == (int16_t) floor_div(f.v, 65536), "fix_int_part", f.v, 0, fix_int_part(f));
+	check(fix_fract_part(f) == f.v - floor_div(f.v, 65536) * 65536, "fix_fract_part", f.v, 0,
+	      fix_fract_part(f));
+	if (fits(-(wide_t) f.v)) {
+		check(fixneg(f).v == -(wide_t) f.v, "fixneg", f.v, 0, fixneg(f).v);
+	}
+}
+
+static void check_binary(fixed_t f, fixed_t g) {
+	wide_t sum = (wide_t) f.v + g.v;
+	if (fits(sum)) {
+		check(fixadd(f, g).v == sum, "fixadd", f.v, g.v, fixadd(f, g).v);
+	}
+
+	wide_t difference = (wide_t) f.v - g.v;
+	if (fits(difference)) {
+		check(fixsub(f, g).v == difference, "fixsub", f.v, g.v, fixsub(f, g).v);
+	}
+
+	wide_t product = floor_div((wide_t) f.v * g.v, 65536);
+	if (fits(product)) {
+		check(fixmul(f, g).v == product, "fixmul", f.v, g.v, fixmul(f, g).v);
+	}
+
+	// fixdiv truncates towards zero, like the C division.
+	if (g.v != 0) {
+		wide_t quotient = (wide_t) f.v * 65536 / g.v;
+		if (fits(quotient)) {
+			check(fixdiv(f, g).v == quotient, "fixdiv", f.v, g.v, fixdiv(f, g).v);
+		}
+	}
+
+	check(fixlt(f, g) == (f.v < g.v), "fixlt", f.v, g.v, fixlt(f, g));
+	check(fixgt(f, g) == (f.v > g.v), "fixgt", f.v, g.v, fixgt(f, g));
+	check(fixle(f, g) == (f.v <= g.v), "fixle", f.v, g.v, fixle(f, g));
+	check(fixge(f, g) == (f.v >= g.v), "fixge", f.v, g.v, fixge(f, g));
+	check(fixeq(f, g) == (f.v == g.v), "fixeq", f.v, g.v, fixeq(f, g));
+	check(fixne(f, g) == (f.v != g.v), "fixne", f.v, g.v, fixne(f, g));
+	check(fixmin(f, g).v == (f.v < g.v ? f.v : g.v), "fixmin", f.v, g.v, fixmin(f, g).v);
+	check(fixmax(f, g).v == (f.v > g.v ? f.v : g.v), "fixmax", f.v, g.v, fixmax(f, g).v);
+}
+
+static void check_ternary(const fixed_t a[3], const fixed_t b[3]) {
+	wide_t sum = (wide_t) a[0].v + a[1].v + a[2].v;
+	if (fits(sum)) {
+		check(fixadd3(a[0], a[1], a[2]).v == sum, "fixadd3", a[0].v, a[1].v,
+		      fixadd3(a[0], a[1], a[2]).v);
+	}
+
+	// fixdot3 sums in 64 bits (see fixedpoint.h).
+	wide_t products = (wide_t) a[0].v * b[0].v + (wide_t) a[1].v * b[1].v +
+		(wide_t) a[2].v * b[2].v;
+	wide_t dot = floor_div(products, 65536);
+	if (products >= INT64_MIN && products <= INT64_MAX && fits(dot)) {
+		check(fixdot3(a, b).v == dot, "fixdot3", a[0].v, b[0].v, fixdot3(a, b).v);
+	}
+}
+
+int main() {
+	static const int32_t edges[] = {
+		0, 1, -1, 0xffff, 0x10000, -0x10000, 0x7fff, 0x8000,
+		INT16_MAX, INT16_MIN, INT32_MAX, INT32_MIN, INT32_MAX - 1, INT32_MIN + 1
+	};
+	const int edge_count = sizeof(edges) / sizeof(edges[0]);
+
+	for (int i = 0; i < edge_count; i++) {
+		fixed_t f = { edges[i] };
+		check_unary(f, (int16_t) edges[i], (uint16_t) edges[i]);
+		for (int j = 0; j < edge_count; j++) {
+			check_binary(f, (fixed_t) { edges[j] });
+		}
+	}
+
+	for (long r = 0; r < ROUNDS; r++) {
+		fixed_t a[3] = { random_fixed(), random_fixed(), random_fixed() };
+		fixed_t b[3] = { random_fixed(), random_fixed(), random_fixed() };
+
+		check_unary(a[0], (int16_t) b[0].v, (uint16_t) b[1].v);
+		check_binary(a[0], b[0]);
+		check_ternary(a, b);
+	}
+
+	printf("fixedpoint: %lu checks, %lu failures\n", checks, failures);
+	return failures != 0;
+}
@@ -0,0 +1,67 @@
+#ifndef HOST_H
+#define HOST_H
+
+/*
+ * Interface of the host HAL (host_hal.c) to the replay tool and the
+ * tests. The HAL stands in for the hardware dependent modules of the
+ * firmware (pwm_hal.c, heat_hal.c, usart2_hal.c, console.c, error.c,
+ * flash.c), so that the core (command.c, color.c, config.c, fail.c,
+ * fixedpoint.c, heat.c, pwm.c, usart2.c) can run on a host.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+
+/*
+ * Appends the given bytes to the receive ring, as the DMA would when
+ * they arrive on the bus, and parses them like the interrupts would.
+ */
+void host_receive(const uint8_t *bytes, size_t count);
+
+/*
+ * The RAM the command queue gets, in bytes. This must be set before
+ * usart2_init is called.
+ */
+extern uint32_t host_cmd_memory;
+
+/*
+ * The outputs of the PWM channels: how many of the PWM_RELOAD + 1
+ * timer ticks of each PWM period they are on.
+ */
+extern uint16_t host_pwm_outputs[MODULE_LENGTH];
+
+/*
+ * The type of function that can be passed to host_set_frame_handler.
+ * It gets host_pwm_outputs.
+ */
+typedef void (*host_frame_handler_t)(const uint16_t outputs[MODULE_LENGTH]);
+
+/*
+ * Sets the function that is called whenever the outputs of the PWM
+ * channels change.
+ */
+void host_set_frame_handler(host_frame_handler_t handler);
+
+/*
+ * Plays the given number of PWM periods: at the start of each, the
+ * timers load the values pwm.c has written since the last one, and
+ * the update interrupt runs if pwm.c has enabled it.
+ */
+void host_pwm_periods(unsigned long count);
+
+/*
+ * The temperatures the heat sensors report, in ADC units.
+ */
+extern uint16_t host_temperatures[HEAT_SENSOR_LEN];
+
+/*
+ * Number of errors raised by the core, and how many of them were
+ * ER_CMDOVERFLOW.
+ */
+extern unsigned int host_errors;
+extern unsigned int host_overflows;
+
+#endif
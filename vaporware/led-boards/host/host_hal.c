@@ -0,0 +1,289 @@
+#include "host.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "console.h"
+#include "error.h"
+#include "flash.h"
+#include "heat_hal.h"
+#include "main.h"
+#include "pwm_hal.h"
+#include "usart2.h"
+#include "usart2_hal.h"
+
+/*
+ * Host versions of the hardware dependent functions the firmware core
+ * calls. Console output goes to stderr.
+ */
+
+unsigned int host_errors = 0;
+unsigned int host_overflows = 0;
+uint32_t host_cmd_memory = 1024;
+
+volatile uint32_t board_time = 0;
+
+/*
+ * Bus reception: host_receive plays the DMA and its interrupts.
+ */
+
+unsigned char usart2_rx_ring[USART_RX_RING_LEN];
+
+static uint32_t rx_produced = 0;
+
+void host_receive(const uint8_t *bytes, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		usart2_rx_ring[rx_produced % USART_RX_RING_LEN] = bytes[i];
+		rx_produced++;
+
+		// Half and full transfer interrupts.
+		if (rx_produced % (USART_RX_RING_LEN / 2) == 0) {
+			usart2_parse();
+		}
+	}
+
+	// The line goes idle.
+	usart2_parse();
+}
+
+unsigned char *usart2_cmd_memory(uint32_t *length) {
+	static unsigned char *memory;
+
+	if (!memory) {
+		memory = malloc(host_cmd_memory);
+	}
+	*length = host_cmd_memory;
+	return memory;
+}
+
+void usart2_hal_init() {
+}
+
+uint32_t usart2_rx_produced() {
+	return rx_produced;
+}
+
+uint32_t usart2_rx_errors(uint32_t *at) {
+	// A recording has no framing or parity errors.
+	*at = 0;
+	return 0;
+}
+
+uint32_t usart2_rx_error_count(usart_error_kind_t kind) {
+	(void) kind;
+	return 0;
+}
+
+/*
+ * PWM: the timers are modelled as far as pwm.c can tell. Each channel
+ * has a CCRx that is preloaded, and loaded into the active one at the
+ * overflows, which host_pwm_periods plays.
+ */
+
+uint16_t host_pwm_outputs[MODULE_LENGTH];
+
+static uint16_t preload[MODULE_LENGTH];
+static uint16_t active[MODULE_LENGTH];
+static uint16_t end_aligned = 0;
+static bool outputs_on = false;
+static bool updates_held = false;
+static bool update_interrupt = false;
+static host_frame_handler_t frame_handler;
+
+void host_set_frame_handler(host_frame_handler_t handler) {
+	frame_handler = handler;
+}
+
+/*
+ * Updates host_pwm_outputs from the active CCRx and the modes, and
+ * calls the frame handler if they changed.
+ */
+static void show_outputs() {
+	bool changed = false;
+
+	for (int i = 0; i < MODULE_LENGTH; i++) {
+		// PWM mode 1 is on up to the CCRx, mode 2 from there on.
+		uint32_t on = active[i] > PWM_RELOAD ? PWM_RELOAD + 1 : active[i];
+		if (end_aligned & (1 << i)) {
+			on = PWM_RELOAD + 1 - on;
+		}
+		if (!outputs_on) {
+			on = 0;
+		}
+
+		if (host_pwm_outputs[i] != on) {
+			host_pwm_outputs[i] = on;
+			changed = true;
+		}
+	}
+
+	if (changed && frame_handler) {
+		frame_handler(host_pwm_outputs);
+	}
+}
+
+static void load_channels() {
+	for (int i = 0; i < MODULE_LENGTH; i++) {
+		active[i] = preload[i];
+	}
+	show_outputs();
+}
+
+void host_pwm_periods(unsigned long count) {
+	for (unsigned long p = 0; p < count; p++) {
+		if (!updates_held) {
+			load_channels();
+		}
+		if (update_interrupt) {
+			pwm_period();
+		}
+	}
+}
+
+void pwm_hal_init() {
+	pwm_hal_outputs(true);
+}
+
+void pwm_hal_start() {
+	load_channels();
+}
+
+void pwm_hal_outputs(bool on) {
+	outputs_on = on;
+	show_outputs();
+}
+
+void pwm_hal_set_mode(int channel, bool end_aligned_mode) {
+	if (end_aligned_mode) {
+		end_aligned |= 1 << channel;
+	} else {
+		end_aligned &= ~(1 << channel);
+	}
+
+	// The mode takes effect at once.
+	show_outputs();
+}
+
+void pwm_hal_write(int channel, uint16_t ccr) {
+	preload[channel] = ccr;
+}
+
+void pwm_hal_hold() {
+	updates_held = true;
+}
+
+void pwm_hal_release() {
+	updates_held = false;
+}
+
+void pwm_hal_update_interrupt(bool enabled) {
+	update_interrupt = enabled;
+}
+
+/*
+ * Heat sensors: they read whatever host_temperatures says.
+ */
+
+uint16_t host_temperatures[HEAT_SENSOR_LEN];
+
+void heat_hal_init() {
+}
+
+uint16_t heat_hal_sample(int sensor) {
+	return host_temperatures[sensor];
+}
+
+/*
+ * Errors are counted. Those that would stop the board stop the host
+ * program, too.
+ */
+
+void error(err_reason_t reason, char *message, int length, err_action_t action) {
+	host_errors++;
+	if (reason == ER_CMDOVERFLOW) {
+		host_overflows++;
+	}
+
+	fprintf(stderr, "error: %.*s\n", length, message);
+
+	if (action != EA_RESUME) {
+		exit(2);
+	}
+}
+
+/*
+ * Console output.
+ */
+
+void console_putchar(const char message) {
+	fputc(message, stderr);
+}
+
+void console_write_raw(const char *message, unsigned length) {
+	fwrite(message, 1, length, stderr);
+}
+
+void console_uint(unsigned value, unsigned base, int min_width, char padding) {
+	char digits[33];
+	int n = 0;
+
+	do {
+		digits[n++] = "0123456789abcdefghijklmnopqrstuvwxyz"[value % base];
+		value /= base;
+	} while (value != 0);
+
+	for (; min_width > n; min_width--) {
+		fputc(padding, stderr);
+	}
+	while (n > 0) {
+		fputc(digits[--n], stderr);
+	}
+}
+
+void console_sint(int value, unsigned base, int min_width, char padding) {
+	if (value < 0) {
+		fputc('-', stderr);
+		console_uint(-(unsigned) value, base, min_width - 1, padding);
+	} else {
+		console_uint(value, base, min_width, padding);
+	}
+}
+
+void console_fixed(fixed_t value, unsigned base) {
+	(void) base;
+	fprintf(stderr, "%f", value.v / 65536.0);
+}
+
+void console_request_config_mode() {
+	fprintf(stderr, "config mode requested\n");
+}
+
+/*
+ * There is no flash to save the configuration to.
+ */
+
+error_t flash_unlock() {
+	return E_SUCCESS;
+}
+
+error_t flash_lock() {
+	return E_SUCCESS;
+}
+
+error_t flash_write_check(uint16_t *address, uint16_t value) {
+	(void) address;
+	(void) value;
+	return E_FLASH_WRITE;
+}
+
+error_t flash_erase_page(void *base_addr) {
+	(void) base_addr;
+	return E_FLASH_WRITE;
+}
+
+error_t flash_copy(void *destination, void *source, int hw_count) {
+	(void) destination;
+	(void) source;
+	(void) hw_count;
+	return E_FLASH_WRITE;
+}
@@ -0,0 +1,349 @@
+/*
+ * Sends commands over the bus to the firmware core and checks what
+ * the PWM channels put out in the PWM periods after them: frames that
+ * are shown at once, fades, frames scheduled with "strobe at",
+ * derating by the heat sensors, dithering and end aligned channels.
+ *
+ * The outputs are the timer ticks per period each channel is on (see
+ * host_pwm_outputs), so they are independent of the PWM mode of the
+ * channel.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "color.h"
+#include "command.h"
+#include "config.h"
+#include "heat.h"
+#include "main.h"
+#include "pwm.h"
+#include "usart2.h"
+
+#include "host.h"
+
+#define ADDRESS 3
+#define BROADCAST 0xff
+
+#define CMD_SET_RAW 0x00
+#define CMD_FADE_RAW 0x02
+#define CMD_STROBE_AT 0x07
+#define CMD_STROBE 0xff
+
+static unsigned checks = 0;
+static unsigned failures = 0;
+
+static void check(bool ok, const char *what) {
+	checks++;
+	if (!ok) {
+		failures++;
+		printf("FAILED: %s\n", what);
+	}
+}
+
+/*
+ * Returns whether all channels put out the given values.
+ */
+static bool outputs_are(const uint16_t values[MODULE_LENGTH]) {
+	for (int i = 0; i < MODULE_LENGTH; i++) {
+		if (host_pwm_outputs[i] != values[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Runs the commands that have arrived, like the main loop of the
+ * board.
+ */
+static void main_loop() {
+	unsigned char *command;
+
+	while ((command = usart2_next_command()) != NULL) {
+		check(run_command(command) == E_SUCCESS, "the commands run");
+	}
+	pwm_tick(board_time);
+}
+
+/*
+ * Sends the given command to the given address, escaped as on the bus,
+ * and runs it.
+ */
+static void send(uint8_t address, const uint8_t *command, size_t length) {
+	uint8_t frame[2 * (1 + CMD_BUFFER_LEN) + 1];
+	size_t count = 0;
+
+	frame[count++] = START_MARK;
+	for (size_t i = 0; i <= length; i++) {
+		uint8_t byte = i == 0 ? address : command[i - 1];
+		if (byte == ESCAPE_MARK || byte == START_MARK) {
+			frame[count++] = ESCAPE_MARK;
+			byte = byte == ESCAPE_MARK ? 0x00 : 0x01;
+		}
+		frame[count++] = byte;
+	}
+
+	host_receive(frame, count);
+	main_loop();
+}
+
+static void put_uint16(uint8_t *out, uint16_t value) {
+	out[0] = value >> 8;
+	out[1] = value & 0xff;
+}
+
+static void set_raw(const uint16_t values[MODULE_LENGTH]) {
+	uint8_t command[1 + 2 * MODULE_LENGTH] = { CMD_SET_RAW };
+	for (int i = 0; i < MODULE_LENGTH; i++) {
+		put_uint16(command + 1 + 2 * i, values[i]);
+	}
+	send(ADDRESS, command, sizeof(command));
+}
+
+static void fade_raw(uint16_t duration, const uint16_t values[MODULE_LENGTH]) {
+	uint8_t command[1 + 2 + 2 * MODULE_LENGTH] = { CMD_FADE_RAW };
+	put_uint16(command + 1, duration);
+	for (int i = 0; i < MODULE_LENGTH; i++) {
+		put_uint16(command + 3 + 2 * i, values[i]);
+	}
+	send(ADDRESS, command, sizeof(command));
+}
+
+static void strobe() {
+	const uint8_t command[] = { CMD_STROBE };
+	send(BROADCAST, command, sizeof(command));
+}
+
+static void strobe_at(uint32_t time) {
+	const uint8_t command[] = {
+		CMD_STROBE_AT, time >> 24, (time >> 16) & 0xff, (time >> 8) & 0xff, time & 0xff
+	};
+	send(BROADCAST, command, sizeof(command));
+}
+
+/*
+ * A frame is shown at the start of the next PWM period after its
+ * strobe.
+ */
+static void test_strobe() {
+	uint16_t values[MODULE_LENGTH];
+	for (int i = 0; i < MODULE_LENGTH; i++) {
+		values[i] = 0x1000 * i + 0x0123;
+	}
+	const uint16_t zero[MODULE_LENGTH] = { 0 };
+
+	set_raw(values);
+	host_pwm_periods(1);
+	check(outputs_are(zero), "a frame isn't shown before its strobe");
+
+	strobe();
+	check(outputs_are(zero), "a frame is only shown at the next period");
+	host_pwm_periods(1);
+	check(outputs_are(values), "a frame is shown in the period after its strobe");
+}
+
+/*
+ * A fade takes one step per PWM period.
+ */
+static void test_fade() {
+	uint16_t from[MODULE_LENGTH], to[MODULE_LENGTH], step[MODULE_LENGTH];
+	for (int i = 0; i < MODULE_LENGTH; i++) {
+		from[i] = 0x0123 + 0x1000 * i;
+		to[i] = 0xf000 - 0x0f00 * i;
+	}
+
+	set_raw(from);
+	strobe();
+	host_pwm_periods(1);
+
+	const uint16_t duration = 100;
+	const uint32_t steps = (uint32_t) duration * (PWM_CLOCK / 1000) / (PWM_RELOAD + 1);
+
+	fade_raw(duration, to);
+	strobe();
+	host_pwm_periods(1);
+	check(outputs_are(from), "a fade starts with the old values");
+
+	bool on_course = true;
+	for (uint32_t s = 1; s <= steps; s++) {
+		// The step computed at the start of one period is shown in
+		// the next one.
+		host_pwm_periods(1);
+		uint32_t progress = (s << 16) / steps;
+		for (int i = 0; i < MODULE_LENGTH; i++) {
+			step[i] = ((uint32_t) from[i] * (0x10000 - progress) +
+				   (uint32_t) to[i] * progress) >> 16;
+		}
+		on_course = on_course && outputs_are(step);
+
+		// A strobe for other modules doesn't cut the fade short.
+		if (s == steps / 2) {
+			strobe();
+		}
+	}
+	check(on_course, "a fade shows one step in each period");
+	check(outputs_are(to), "a fade ends with the new values");
+
+	host_pwm_periods(10);
+	check(outputs_are(to), "the values stay after a fade");
+}
+
+/*
+ * A frame scheduled with "strobe at" is shown in the first period
+ * after its board time has come.
+ */
+static void test_strobe_at() {
+	uint16_t before[MODULE_LENGTH], after[MODULE_LENGTH];
+	for (int i = 0; i < MODULE_LENGTH; i++) {
+		before[i] = 0x0200 * i;
+		after[i] = 0xff00 - 0x0300 * i;
+	}
+
+	board_time = 1000;
+	set_raw(before);
+	strobe();
+	host_pwm_periods(1);
+
+	set_raw(after);
+	strobe_at(1010);
+	host_pwm_periods(1);
+	check(outputs_are(before), "a scheduled frame isn't shown at once");
+
+	board_time = 1009;
+	main_loop();
+	host_pwm_periods(1);
+	check(outputs_are(before), "a scheduled frame isn't shown early");
+
+	board_time = 1010;
+	main_loop();
+	check(outputs_are(before), "a scheduled frame is only shown at the next period");
+	host_pwm_periods(1);
+	check(outputs_are(after), "a scheduled frame is shown when its time has come");
+}
+
+static bool overheated = false;
+
+static void on_overheat() {
+	overheated = true;
+}
+
+/*
+ * A hot heat sensor dims its channels, and they come back when it has
+ * cooled down.
+ */
+static void test_derating() {
+	uint16_t values[MODULE_LENGTH], dimmed[MODULE_LENGTH];
+	const uint16_t limit = 1000;
+	const uint16_t temperature = limit - HEAT_DERATE_RANGE / 2;
+	const uint32_t factor = PWM_FULL_OUTPUT - (PWM_FULL_OUTPUT - HEAT_DERATE_MIN) / 2;
+
+	for (int i = 0; i < MODULE_LENGTH; i++) {
+		values[i] = 0xffff - 0x0f0f * i;
+		dimmed[i] = ((uint32_t) values[i] * factor) >> 16;
+	}
+
+	set_raw(values);
+	strobe();
+	host_pwm_periods(1);
+
+	config.heat_limit[0] = limit;
+	heat_init(on_overheat);
+	host_temperatures[0] = temperature;
+	heat_timer_tick();
+	check(outputs_are(values), "derating only changes the next period");
+	host_pwm_periods(1);
+	check(outputs_are(dimmed), "a hot sensor dims its channels");
+
+	host_temperatures[0] = 0;
+	for (int t = 0; t < 100; t++) {
+		heat_timer_tick();
+	}
+	host_pwm_periods(1);
+	check(outputs_are(values), "the channels come back when the sensor has cooled down");
+	check(!overheated, "derating doesn't overheat");
+
+	config.heat_limit[0] = 0xffff;
+}
+
+/*
+ * A dithered channel alternates between the two nearest values, so
+ * that it averages out to its exact level.
+ */
+static void test_dithering() {
+	uint16_t values[MODULE_LENGTH] = { 1 };
+	uint32_t factors[MODULE_LENGTH];
+
+	config.dither_channels = 0x0001;
+	set_raw(values);
+	strobe();
+	host_pwm_periods(1);
+
+	// The level of channel 0 is 5/8 timer ticks.
+	for (int i = 0; i < MODULE_LENGTH; i++) {
+		factors[i] = 5 << (16 - PWM_DITHER_BITS);
+	}
+	pwm_set_derating(factors);
+	host_pwm_periods(2);
+
+	unsigned sum = 0;
+	bool only_nearest = true;
+	for (int p = 0; p < (1 << PWM_DITHER_BITS); p++) {
+		host_pwm_periods(1);
+		sum += host_pwm_outputs[0];
+		only_nearest = only_nearest && host_pwm_outputs[0] <= 1;
+	}
+	check(only_nearest, "a dithered channel only shows the two nearest values");
+	check(sum == 5, "a dithered channel averages out to its level");
+
+	for (int i = 0; i < MODULE_LENGTH; i++) {
+		factors[i] = PWM_FULL_OUTPUT;
+	}
+	pwm_set_derating(factors);
+	config.dither_channels = 0;
+	host_pwm_periods(1);
+	check(outputs_are(values), "a channel without fraction isn't dithered");
+}
+
+/*
+ * Channels in PWM mode 2 are on for as long as those in mode 1.
+ */
+static void test_end_aligned() {
+	uint16_t values[MODULE_LENGTH];
+	for (int i = 0; i < MODULE_LENGTH; i++) {
+		values[i] = i % 4 == 0 ? 0xffff : 0x0f00 * i;
+	}
+
+	config.end_aligned_channels = 0x5555;
+	set_raw(values);
+	strobe();
+	host_pwm_periods(1);
+	check(outputs_are(values), "end aligned channels are on as long as the others");
+
+	config.end_aligned_channels = 0;
+	values[0] = 0;
+	set_raw(values);
+	strobe();
+	host_pwm_periods(1);
+	check(outputs_are(values), "channels can be switched back to PWM mode 1");
+}
+
+int main() {
+	config.my_address = ADDRESS;
+	config_valid();
+
+	pwm_init();
+	command_init();
+	usart2_init();
+
+	test_strobe();
+	test_fade();
+	test_strobe_at();
+	test_derating();
+	test_dithering();
+	test_end_aligned();
+
+	printf("pwm: %u checks, %u failures, %u errors\n", checks, failures, host_errors);
+	return failures != 0 || host_errors != 0;
+}
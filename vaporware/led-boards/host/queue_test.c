@@ -0,0 +1,169 @@
+/*
+ * Sends bursts of commands for this module over the bus, faster than
+ * the main loop takes them from the command queue, and checks that the
+ * commands that don't fit are dropped and counted, and that the
+ * queued ones come out intact and in the order they were sent.
+ *
+ * Every command carries its sequence number, and its bytes are derived
+ * from it, so a command that was overwritten, cut or reordered shows
+ * up. The values contain the start and escape marks, so the escaping
+ * is exercised as well.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "command.h"
+#include "config.h"
+#include "usart2.h"
+
+#include "host.h"
+
+#define ADDRESS 3
+
+#define CMD_SET_RAW 0x00
+#define CMD_SET_RAW8 0x04
+
+static unsigned checks = 0;
+static unsigned failures = 0;
+
+static void check(bool ok, const char *what) {
+	checks++;
+	if (!ok) {
+		failures++;
+		printf("FAILED: %s\n", what);
+	}
+}
+
+/*
+ * Writes the command with the given sequence number to command and
+ * returns its length. The commands alternate between two lengths, so
+ * that they end up at all kinds of places in the queue.
+ */
+static size_t make_command(unsigned seq, uint8_t *command) {
+	size_t length = seq % 2 == 0 ? 1 + 2 * MODULE_LENGTH : 1 + MODULE_LENGTH;
+
+	command[0] = seq % 2 == 0 ? CMD_SET_RAW : CMD_SET_RAW8;
+	command[1] = seq >> 8;
+	command[2] = seq & 0xff;
+	for (size_t i = 3; i < length; i++) {
+		command[i] = (uint8_t) (START_MARK - 2 + seq + i);
+	}
+	return length;
+}
+
+/*
+ * Sends the commands with the given sequence numbers, escaped as on
+ * the bus. The parser runs as the bytes arrive, but the main loop
+ * doesn't.
+ */
+static void send(unsigned first, unsigned count) {
+	for (unsigned seq = first; seq < first + count; seq++) {
+		uint8_t command[CMD_BUFFER_LEN];
+		uint8_t frame[2 * (1 + CMD_BUFFER_LEN) + 1];
+		size_t length = make_command(seq, command);
+		size_t n = 0;
+
+		frame[n++] = START_MARK;
+		for (size_t i = 0; i <= length; i++) {
+			uint8_t byte = i == 0 ? ADDRESS : command[i - 1];
+			if (byte == ESCAPE_MARK || byte == START_MARK) {
+				frame[n++] = ESCAPE_MARK;
+				byte = byte == ESCAPE_MARK ? 0x00 : 0x01;
+			}
+			frame[n++] = byte;
+		}
+		host_receive(frame, n);
+	}
+}
+
+/*
+ * Sequence number of the next command expected out of the queue, and
+ * whether all commands so far were intact and in order.
+ */
+static unsigned next_seq = 0;
+static unsigned received = 0;
+static bool intact = true;
+static bool in_order = true;
+
+/*
+ * Takes up to max commands from the queue, like the main loop, and
+ * checks them. Returns the number taken.
+ */
+static unsigned take(unsigned max) {
+	unsigned taken = 0;
+	unsigned char *command;
+
+	while (taken < max && (command = usart2_next_command()) != NULL) {
+		uint8_t expected[CMD_BUFFER_LEN];
+		unsigned seq = command[1] << 8 | command[2];
+		size_t length = make_command(seq, expected);
+
+		// Dropped commands leave gaps, but nothing may come back.
+		in_order = in_order && seq >= next_seq;
+		intact = intact && memcmp(command, expected, length) == 0;
+		next_seq = seq + 1;
+		received++;
+		taken++;
+	}
+	return taken;
+}
+
+static uint32_t dropped() {
+	usart_stats_t stats;
+	usart2_get_stats(&stats);
+	return stats.dropped_commands;
+}
+
+int main() {
+	// Room for a few commands only, so that the memory runs out before
+	// the frames.
+	host_cmd_memory = 4 * CMD_BUFFER_LEN;
+	config.my_address = ADDRESS;
+	command_init();
+	usart2_init();
+
+	// 1. A burst while the main loop is busy: the first commands are
+	// queued, the rest is dropped.
+	const unsigned burst = 20;
+	send(0, burst);
+	take(burst);
+	char what[100];
+	snprintf(what, sizeof(what), "some of a burst are queued (%u of %u)", received, burst);
+	check(received >= 3 && received < burst, what);
+	check(next_seq == received, "the first commands of a burst are queued");
+	check(dropped() == burst - received, "the commands that don't fit are counted as dropped");
+	check(host_overflows == 1, "a burst is reported as one overflow");
+
+	// 2. Steady overload: three commands arrive for each one the main
+	// loop runs, so the queue wraps around at all kinds of places.
+	unsigned sent = burst;
+	unsigned received_before = received;
+	for (int pass = 0; pass < 200; pass++) {
+		send(sent, 3);
+		sent += 3;
+		take(1);
+	}
+	take(sent);
+	check(received + dropped() == sent, "every command is either queued or dropped");
+	check(received - received_before >= 200, "the queue keeps taking commands under overload");
+
+	// 3. Without overload, nothing is dropped.
+	uint32_t dropped_before = dropped();
+	for (int pass = 0; pass < 200; pass++) {
+		send(sent, 1);
+		sent++;
+		take(1);
+	}
+	check(dropped() == dropped_before, "nothing is dropped while the main loop keeps up");
+	check(next_seq == sent, "all commands are queued while the main loop keeps up");
+
+	check(intact, "the queued commands are intact");
+	check(in_order, "the queued commands are in order");
+
+	printf("queue: %u commands, %u dropped, %u checks, %u failures\n",
+	       sent, (unsigned) dropped(), checks, failures);
+	return failures != 0;
+}
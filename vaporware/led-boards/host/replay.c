@@ -0,0 +1,292 @@
+/*
+ * Feeds recorded bus traffic to the firmware core on a host and
+ * reports the outputs of the PWM channels, command overflows and the
+ * time the parser and each command take.
+ *
+ * The recordings are the raw bytes as they are sent on the bus (start
+ * marks, escaped payloads). Instead of recordings, a synthetic load can
+ * be generated: frames of SET_XYY commands for a chain of modules, each
+ * followed by a strobe.
+ *
+ * The main loop of the board is simulated: in each pass, a number of
+ * bytes arrives and is parsed like the interrupts would, and at most
+ * one command is run. The PWM periods that pass on the board in the
+ * meantime are played as well, so fades, dithering and "strobe at"
+ * run like on the board. If more commands for the module arrive per pass
+ * than one on average, the command queue overflows (ER_CMDOVERFLOW),
+ * just like on the board when the main loop is too slow for the bus.
+ *
+ * The times are measured on the host, so they are only good for
+ * comparing changes to the parser and the commands, not for the
+ * cycle counts on the board.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "command.h"
+#include "config.h"
+#include "main.h"
+#include "pwm.h"
+#include "usart2.h"
+
+#include "host.h"
+
+/*
+ * Time spent on each command code, in ns.
+ */
+typedef struct {
+	unsigned long count;
+	unsigned long long total;
+	unsigned long long max;
+} cost_t;
+
+static cost_t command_costs[256];
+static cost_t parser_cost;
+
+static unsigned long frames = 0;
+static bool print_frames = true;
+
+static unsigned long long now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void add_cost(cost_t *cost, unsigned long long ns) {
+	cost->count++;
+	cost->total += ns;
+	if (ns > cost->max) {
+		cost->max = ns;
+	}
+}
+
+static void print_frame(const uint16_t outputs[MODULE_LENGTH]) {
+	frames++;
+	if (!print_frames) {
+		return;
+	}
+
+	printf("frame %lu @%ums:", frames, (unsigned) board_time);
+	for (int i = 0; i < MODULE_LENGTH; i++) {
+		printf(" %04x", outputs[i]);
+	}
+	printf("\n");
+}
+
+/*
+ * Runs one pass of the main loop. Returns whether there was anything
+ * to do.
+ */
+static bool main_loop_pass() {
+	unsigned char *command = usart2_next_command();
+
+	if (command == NULL) {
+		pwm_tick(board_time);
+		return false;
+	}
+
+	unsigned long long start = now_ns();
+	error_t ret = run_command(command);
+	add_cost(&command_costs[command[0]], now_ns() - start);
+
+	if (ret != E_SUCCESS) {
+		fprintf(stderr, "command 0x%02x failed: %d\n", command[0], ret);
+	}
+
+	pwm_tick(board_time);
+	return true;
+}
+
+/*
+ * Receives the given bytes from the bus, bytes_per_pass at a time, and
+ * runs a main loop pass after each.
+ */
+static unsigned long long bytes = 0;
+static unsigned long long pwm_periods = 0;
+
+static void replay(const uint8_t *buffer, size_t length, size_t bytes_per_pass) {
+	for (size_t pos = 0; pos < length; pos += bytes_per_pass) {
+		size_t count = length - pos < bytes_per_pass ? length - pos : bytes_per_pass;
+
+		unsigned long long start = now_ns();
+		host_receive(buffer + pos, count);
+		add_cost(&parser_cost, now_ns() - start);
+		bytes += count;
+
+		// 10 bits per byte on the bus.
+		board_time = bytes * 10 * 1000 / BUS_BAUDRATE;
+
+		unsigned long long periods = bytes * 10 * PWM_CLOCK /
+			((unsigned long long) BUS_BAUDRATE * (PWM_RELOAD + 1));
+		host_pwm_periods(periods - pwm_periods);
+		pwm_periods = periods;
+
+		main_loop_pass();
+	}
+}
+
+/*
+ * Appends a frame with the given payload to out, escaped as on the bus.
+ * Returns the new length of out.
+ */
+static size_t add_frame(uint8_t *out, size_t length, uint8_t address,
+			const uint8_t *payload, size_t count) {
+	out[length++] = START_MARK;
+	for (size_t i = 0; i <= count; i++) {
+		uint8_t byte = i == 0 ? address : payload[i - 1];
+		if (byte == ESCAPE_MARK || byte == START_MARK) {
+			out[length++] = ESCAPE_MARK;
+			byte = byte == ESCAPE_MARK ? 0x00 : 0x01;
+		}
+		out[length++] = byte;
+	}
+	return length;
+}
+
+/*
+ * Replays the given number of synthetic frames: SET_XYY commands for
+ * the given number of modules (addresses 0 and up), followed by a
+ * strobe.
+ */
+static void replay_synthetic(unsigned long count, unsigned int modules, size_t bytes_per_pass) {
+	// Escaping at most doubles the bytes.
+	uint8_t *buffer = malloc(modules * 2 * (3 + 1 + 6 * RGB_LED_COUNT) + 2 * 3);
+	const uint8_t strobe = 0xff;
+
+	for (unsigned long f = 0; f < count; f++) {
+		size_t length = 0;
+
+		for (unsigned int m = 0; m < modules; m++) {
+			uint8_t set_xyY[1 + 6 * RGB_LED_COUNT] = { 0x01 };
+			for (int i = 1; i < (int) sizeof(set_xyY); i++) {
+				set_xyY[i] = (uint8_t) (f * 7 + m * 3 + i);
+			}
+			length = add_frame(buffer, length, m, set_xyY, sizeof(set_xyY));
+		}
+		length = add_frame(buffer, length, 0xff, &strobe, 1);
+
+		replay(buffer, length, bytes_per_pass);
+	}
+
+	free(buffer);
+}
+
+static void usage(const char *name) {
+	fprintf(stderr,
+		"usage: %s [-a address] [-b bytes-per-pass] [-r queue-bytes] [-q] recording...\n"
+		"       %s [-a address] [-b bytes-per-pass] [-r queue-bytes] [-q] -s frames [-m modules]\n"
+		"  -a  address of the simulated module (default 0)\n"
+		"  -b  bytes arriving on the bus per main loop pass (default 64)\n"
+		"  -r  RAM for the command queue (default 1024)\n"
+		"  -q  don't print the frames\n"
+		"  -s  replay synthetic frames instead of recordings\n"
+		"  -m  modules in the synthetic frames (default 60)\n",
+		name, name);
+	exit(1);
+}
+
+int main(int argc, char *argv[]) {
+	unsigned int address = 0;
+	size_t bytes_per_pass = 64;
+	unsigned long synthetic = 0;
+	unsigned int modules = 60;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "a:b:r:qs:m:")) != -1) {
+		switch (opt) {
+		case 'a':
+			address = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			bytes_per_pass = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			host_cmd_memory = strtoul(optarg, NULL, 0);
+			break;
+		case 'q':
+			print_frames = false;
+			break;
+		case 's':
+			synthetic = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			modules = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if ((optind == argc) == (synthetic == 0) || address > 0xff ||
+	    bytes_per_pass == 0 || host_cmd_memory < CMD_BUFFER_LEN ||
+	    modules == 0 || modules > 0xfd) {
+		usage(argv[0]);
+	}
+
+	config.my_address = address;
+	host_set_frame_handler(print_frame);
+	pwm_init();
+	command_init();
+	usart2_init();
+
+	uint8_t buffer[4096];
+
+	replay_synthetic(synthetic, modules, bytes_per_pass);
+
+	for (int f = optind; f < argc; f++) {
+		FILE *recording = fopen(argv[f], "rb");
+		if (!recording) {
+			perror(argv[f]);
+			return 1;
+		}
+
+		size_t length;
+		while ((length = fread(buffer, 1, sizeof(buffer), recording)) != 0) {
+			replay(buffer, length, bytes_per_pass);
+		}
+
+		fclose(recording);
+	}
+
+	// The bus is silent now; parse what is left, and show the last
+	// frame. Fades that are still running are cut short.
+	while (usart2_data_available()) {
+		main_loop_pass();
+	}
+	host_pwm_periods(1);
+
+	printf("\n%llu bytes (%ums on the bus), %lu frames, %u errors, %u overflows\n",
+	       bytes, (unsigned) board_time, frames, host_errors, host_overflows);
+	usart_stats_t stats;
+	usart2_get_stats(&stats);
+	printf("bus frames %lu, for us %lu, strobes %lu, max backlog %lu of %u bytes\n",
+	       (unsigned long) stats.frames, (unsigned long) stats.frames_accepted,
+	       (unsigned long) command_strobe_count(),
+	       (unsigned long) stats.max_backlog, USART_RX_RING_LEN);
+	printf("command queue: %lu dropped, max %lu queued (of %u, %u bytes)\n",
+	       (unsigned long) stats.dropped_commands, (unsigned long) stats.max_queued,
+	       CMD_FRAME_COUNT, (unsigned) host_cmd_memory);
+	uint32_t hits, misses;
+	command_xyY_cache_stats(&hits, &misses);
+	printf("xyY cache: %lu hits, %lu misses\n",
+	       (unsigned long) hits, (unsigned long) misses);
+	printf("parser: %llu ns total, %.1f ns per byte\n",
+	       parser_cost.total, bytes ? (double) parser_cost.total / bytes : 0.0);
+	printf("command  count    avg ns    max ns\n");
+	for (int c = 0; c < 256; c++) {
+		cost_t *cost = &command_costs[c];
+		if (cost->count == 0) {
+			continue;
+		}
+		printf("   0x%02x %6lu %9llu %9llu\n", c, cost->count,
+		       cost->total / cost->count, cost->max);
+	}
+
+	return host_overflows != 0;
+}
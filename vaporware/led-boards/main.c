@@ -13,6 +13,9 @@
 #include "git_version.h"
 #include "heat.h"
 #include "pwm.h"
+#include "sync.h"
+#include "term.h"
+#include "trace.h"
 #include "usart1.h"
 #include "usart2.h"
 
@@ -22,6 +25,13 @@
  */
 volatile int do_heat_check;
 
+/*
+ * The board time in ms, counted by the systick timer. The bus master
+ * sets it on all boards with the "time sync" command; frames can be
+ * scheduled for a point in this time with "strobe at".
+ */
+volatile uint32_t board_time;
+
 /*
  * What to do when overheat is detected.
  */
@@ -63,6 +73,7 @@ int main() {
 	vl_mode_t mode;
 
 	usart1_init();
+	trace_init();
 
 #ifdef TRACE_STARTUP
 	dled_off();
@@ -74,10 +85,18 @@ int main() {
 
 	ret = load_config();
 
-	// Display the version number on lights during bootup
-	display_boot_colors(ret == E_SUCCESS);
+	if (console_config_requested()) {
+		mode = CONFIG_MODE;
+	} else if (ret == E_SUCCESS) {
+		// Fast boot: with a valid configuration, nobody has to
+		// be asked, so go on to normal mode at once.
+		mode = NORMAL_MODE;
+	} else {
+		// Display the version number on lights during bootup
+		display_boot_colors(false);
 
-	mode = console_ask_mode();
+		mode = console_ask_mode();
+	}
 
 	pwm_set_state(PWM_STOP);
 
@@ -111,6 +130,13 @@ int main() {
 	command_init();
 	usart2_init();
 
+	// The systick counts from heat_init on, which is right after
+	// reset, so this is the time from power up to listening on the
+	// bus (unless the config console ran).
+	console_write("Listening on the bus after ");
+	console_uint_d(board_time);
+	console_write(" ms" CRLF);
+
 	while (1) {
 		command = usart2_next_command();
 
@@ -118,7 +144,9 @@ int main() {
 #ifdef TRACE_COMMANDS
 			debug_string("C:");
 #endif
+			trace_begin(TRACE_COMMAND);
 			ret = run_command(command);
+			trace_end(TRACE_COMMAND);
 
 			if (ret != E_SUCCESS) {
 				error(ER_USART_RX, STR_WITH_LEN("Bogus USART command."), EA_RESUME);
@@ -132,6 +160,10 @@ int main() {
 			}
 		}
 
+		pwm_tick(board_time);
+
+		console_poll();
+
 		if (do_heat_check) {
 #ifdef TRACE_HEAT
 			debug_string("H\n");
@@ -140,6 +172,18 @@ int main() {
 
 			do_heat_check = 0;
 		}
+
+		// Sleep until the next interrupt if there is nothing to do.
+		// The commands are queued by the USART, DMA and systick
+		// interrupts, and the systick wakes us every millisecond for
+		// the scheduled frames anyway. Interrupts are off while we
+		// check, so we can't miss one (wfi still wakes up on pending
+		// interrupts; they are handled when we switch them on again).
+		interrupts_off();
+		if (!usart2_data_available() && !do_heat_check) {
+			__asm("wfi");
+		}
+		interrupts_on();
 	}
 
 	error(ER_BUG, STR_WITH_LEN("End of main reached!"), EA_PANIC);
@@ -5,7 +5,10 @@
 #ifndef MAIN_H
 #define MAIN_H
 
+#include <stdint.h>
+
 extern volatile int do_heat_check;
+extern volatile uint32_t board_time;
 
 int main();
 
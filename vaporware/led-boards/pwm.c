@@ -1,21 +1,15 @@
 #include "pwm.h"
 
 #include "config.h"
-
-#include "stm_include/stm32/timer.h"
+#include "pwm_hal.h"
+#include "sync.h"
+#include "trace.h"
 
 /*
- * Array of all the timer base addresses.
+ * The frames, fades, dithering and derating of the channels. The
+ * timers are only touched through pwm_hal.h, so all of this runs on a
+ * host as well.
  */
-#define TIMER_COUNT 6
-static uint32_t TIMERS[TIMER_COUNT] = {
-	TIM1,
-	TIM2,
-	TIM3,
-	TIM15,
-	TIM16,
-	TIM17
-};
 
 /*
  * The raw PWM values for the LEDs.
@@ -25,52 +19,166 @@ static uint16_t pwm_values[MODULE_LENGTH] = {
 };
 
 /*
- * Functions to manipulate one register in all the timers. Make sure that the
- * register in question is available in all timers (see defines in led.h).
+ * The values currently in the CCRx.
  */
-static void set_each(uint32_t reg_offset, int value) {
-	for (int i = 0; i < TIMER_COUNT; i++) {
-		TR(TIMERS[i], reg_offset) = value;
-	}
+static uint16_t pwm_shown[MODULE_LENGTH] = {
+	[0 ... MODULE_LENGTH - 1] = 0x00
+};
+
+/*
+ * Whether pwm_values or the fade duration were set since the last
+ * pwm_send_frame.
+ */
+static bool frame_changed = false;
+
+/*
+ * The duration of a fade set by pwm_set_fade for the next frame, in ms.
+ */
+static uint16_t fade_duration = 0;
+
+/*
+ * The running fade. It goes from fade_from to fade_to in fade_steps
+ * PWM periods, fade_step of which have passed. No fade is running if
+ * fade_steps is 0. Only pwm_period changes these while a fade runs.
+ */
+static uint16_t fade_from[MODULE_LENGTH];
+static uint16_t fade_to[MODULE_LENGTH];
+static uint32_t fade_step;
+static volatile uint32_t fade_steps = 0;
+
+/*
+ * The factors all values are scaled with before they are written to
+ * the CCRx, in 1/0x10000 (see pwm_set_derating). The values in
+ * pwm_shown are not scaled.
+ */
+static uint32_t pwm_derating[MODULE_LENGTH] = {
+	[0 ... MODULE_LENGTH - 1] = PWM_FULL_OUTPUT
+};
+
+/*
+ * Temporal dithering. The levels of the channels are computed with
+ * PWM_DITHER_BITS fractional bits (see derate). For the channels in
+ * config.dither_channels, pwm_period alternates between the two
+ * nearest CCRx values in successive PWM periods, carrying the error
+ * over (first order sigma-delta), so that they average out to the
+ * exact level. This matters at low levels and at the end of fades to
+ * black, where one step of the timers is a large change.
+ *
+ * dither_active holds the dithered channels whose level has a
+ * fractional part. The update interrupt runs as long as it is not 0;
+ * it does not touch the CCRx of the other channels.
+ */
+#define DITHER_MASK ((1 << PWM_DITHER_BITS) - 1)
+static uint32_t dither_level[MODULE_LENGTH];
+static uint8_t dither_error[MODULE_LENGTH];
+static volatile uint16_t dither_active = 0;
+
+/*
+ * Phase of the pulses. All timers count together, and in PWM mode 1 a
+ * channel switches on at the overflow, so all channels would switch
+ * on at once. The channels in end_aligned run in PWM mode 2 instead,
+ * with the CCRx mirrored (see to_ccr): their pulses end at the
+ * overflow. This spreads the edges over the period, and two channels
+ * of different kinds only overlap if their values add up to more than
+ * one period. end_aligned follows config.end_aligned_channels (see
+ * align_channels).
+ */
+static uint16_t end_aligned = 0;
+
+/*
+ * A frame scheduled with pwm_send_frame_at.
+ */
+typedef struct {
+	uint32_t time;
+	uint16_t fade_duration;
+	bool changed;
+	uint16_t values[MODULE_LENGTH];
+} scheduled_frame_t;
+
+/*
+ * The scheduled frames, as a ring buffer ordered by the time they
+ * were scheduled at.
+ */
+static scheduled_frame_t schedule[PWM_SCHEDULE_LEN];
+static unsigned int schedule_start = 0;
+static unsigned int schedule_count = 0;
+
+/*
+ * Returns the level of the given channel for the given brightness in
+ * 16.16 fixed point: the value for its CCRx with PWM_DITHER_BITS
+ * fractional bits.
+ */
+static inline uint32_t derate(int channel, uint32_t value) {
+	return ((uint64_t) value * pwm_derating[channel]) >> (32 - PWM_DITHER_BITS);
 }
 
-static void or_each(uint32_t reg_offset, int value) {
-	for (int i = 0; i < TIMER_COUNT; i++) {
-		TR(TIMERS[i], reg_offset) |= value;
+/*
+ * Returns the value for the CCRx of the given channel that switches it
+ * on for the given number of timer ticks per period.
+ */
+static inline uint32_t to_ccr(int channel, uint32_t on_ticks) {
+	if (!(end_aligned & (1 << channel))) {
+		return on_ticks;
 	}
+
+	// PWM mode 2 is on from the CCRx to the end of the period.
+	return on_ticks > PWM_RELOAD ? 0 : PWM_RELOAD + 1 - on_ticks;
 }
 
-/* Unused for now...
-static void and_each(uint32_t reg_offset, int value) {
-	for (int i = 0; i < TIMER_COUNT; i++) {
-		TR(TIMERS[i], reg_offset) &= value;
+/*
+ * Switches the channels between PWM mode 1 and 2 if
+ * config.end_aligned_channels has changed. Update events must be
+ * disabled.
+ *
+ * The mode takes effect at once, but the CCRx only at the next
+ * overflow, so a channel that changes shows a wrong value for at most
+ * one period.
+ */
+static void align_channels() {
+	uint16_t wanted = config.end_aligned_channels;
+
+	if (wanted == end_aligned) {
+		return;
+	}
+
+	interrupts_off();
+	for (int i = 0; i < MODULE_LENGTH; i++) {
+		uint16_t bit = 1 << i;
+		if ((wanted ^ end_aligned) & bit) {
+			pwm_hal_set_mode(i, wanted & bit);
+		}
 	}
+	end_aligned = wanted;
+	interrupts_on();
 }
-*/
 
 /*
- * Enable all C/C outputs.
+ * Writes the given level (see derate) to the CCRx of the given
+ * channel, and starts or stops dithering it.
+ *
+ * This changes dither_active, so it must not be called from the main
+ * loop while a fade is running.
  */
-static void enable_all() {
-	// TODO: Can this be written as
-	// 	set_each(CCER, TIM_CCER_CC1E | TIM_CCER_CC2E | TIM_CCER_CC3E | TIM_CCER_CC4E);
-	// or will that produce errors for TIM15-17?
-	// The answer is: It is outside specification and should not be done.
+static void show_level(int channel, uint32_t level) {
+	uint16_t bit = 1 << channel;
 
-	// Note inverted channels in TIM1!
-	TR(TIM1 , CCER) = TIM_CCER_CC1NE | TIM_CCER_CC2NE | TIM_CCER_CC3NE | TIM_CCER_CC4E;
-	TR(TIM2 , CCER) = TIM_CCER_CC1E | TIM_CCER_CC2E | TIM_CCER_CC3E | TIM_CCER_CC4E;
-	TR(TIM3 , CCER) = TIM_CCER_CC1E | TIM_CCER_CC2E | TIM_CCER_CC3E | TIM_CCER_CC4E;
-	TR(TIM15, CCER) = TIM_CCER_CC1E | TIM_CCER_CC2E;
-	TR(TIM16, CCER) = TIM_CCER_CC1E;
-	TR(TIM17, CCER) = TIM_CCER_CC1E;
+	if ((config.dither_channels & bit) && (level & DITHER_MASK)) {
+		dither_level[channel] = level;
+		dither_active |= bit;
+	} else {
+		dither_active &= ~bit;
+	}
+
+	pwm_hal_write(channel, to_ccr(channel, level >> PWM_DITHER_BITS));
 }
 
 /*
- * Disable all C/C outputs.
+ * Enables the update interrupt of TIM1 if a fade is running or
+ * channels are dithered, and disables it otherwise. Interrupts must be
+ * off.
  */
-static void disable_all() {
-	set_each(CCER, 0);
+static void update_interrupt() {
+	pwm_hal_update_interrupt(fade_steps != 0 || dither_active != 0);
 }
 
 /*
@@ -78,52 +186,12 @@ static void disable_all() {
  * any other function in this module.
  */
 void pwm_init() {
-	// Initialize PWM.
-	// Timer configuration should be:
-	// upcounting
-	// ARR = PWM_RELOAD
-	// Send OCxREF to OCx output (CCxE = 1, CCxNE = 0)
-	// PWM mode 1
-	// ... the right register preloading magic.
-
-	set_each(CR1, TIM_CR1_CKD_CK_INT | // Dead-time-clock = internal clock
-		 TIM_CR1_CMS_EDGE |        // Edge mode
-		 TIM_CR1_DIR_UP);          // Count up
-
-
-
-	// Set all outputs to PWM mode 1.
-	// Cannot use set_each here, because timers have
-	// different numbers of channels.
-	TR(TIM1 , CCMR1) = TIM_CCMR1_OC2M_PWM1 | TIM_CCMR1_OC1M_PWM1;
-	TR(TIM1 , CCMR2) = TIM_CCMR2_OC4M_PWM1 | TIM_CCMR2_OC3M_PWM1;
-	TR(TIM2 , CCMR1) = TIM_CCMR1_OC2M_PWM1 | TIM_CCMR1_OC1M_PWM1;
-	TR(TIM2 , CCMR2) = TIM_CCMR2_OC4M_PWM1 | TIM_CCMR2_OC3M_PWM1;
-	TR(TIM3 , CCMR1) = TIM_CCMR1_OC2M_PWM1 | TIM_CCMR1_OC1M_PWM1;
-	TR(TIM3 , CCMR2) = TIM_CCMR2_OC4M_PWM1 | TIM_CCMR2_OC3M_PWM1;
-	TR(TIM15, CCMR1) = TIM_CCMR1_OC2M_PWM1 | TIM_CCMR1_OC1M_PWM1;
-	TR(TIM16, CCMR1) = TIM_CCMR1_OC1M_PWM1;
-	TR(TIM17, CCMR1) = TIM_CCMR1_OC1M_PWM1;
-
-	set_each(ARR, PWM_RELOAD);
-
-	// Enable outputs:
-	// 1. Set Main Output Enable (for those timers that have it)
-	TR(TIM1 , BDTR) = TIM_BDTR_MOE;
-	TR(TIM15, BDTR) = TIM_BDTR_MOE;
-	TR(TIM16, BDTR) = TIM_BDTR_MOE;
-	TR(TIM17, BDTR) = TIM_BDTR_MOE;
-	// 2. Enable outputs
-	enable_all();
+	pwm_hal_init();
 
 	// Set the PWM values
 	pwm_send_frame();
 
-	// Force the registers to be actually loaded.
-	or_each(EGR, TIM_EGR_UG);
-
-	// Finally enable the timers.
-	or_each(CR1, TIM_CR1_CEN);
+	pwm_hal_start();
 }
 
 
@@ -138,18 +206,20 @@ void pwm_set_state(pwm_state_t state) {
 	if (state & PWM_ON) {
 		// Switch on PWM modules
 		// Simply reset CCR values to their previous state.
-		enable_all();
+		pwm_hal_outputs(true);
 	}
 
 	if (state & PWM_OFF) {
 		// Switch off PWM modules
-		disable_all();
+		pwm_hal_outputs(false);
 	}
 
 	if (state & PWM_ZERO) {
 		for (unsigned int l = 0; l < MODULE_LENGTH; l++) {
 			pwm_set_brightness(l, 0);
 		}
+		fade_duration = 0;
+		schedule_count = 0;
 		pwm_send_frame();
 	}
 }
@@ -168,19 +238,255 @@ error_t pwm_set_brightness(uint8_t led, uint16_t brightness) {
 		return E_INDEXRANGE;
 	} else {
 		pwm_values[led] = brightness;
+		frame_changed = true;
 		return E_SUCCESS;
 	}
 }
 
+/*
+ * Makes the next pwm_send_frame fade to the new values in the given
+ * number of milliseconds instead of showing them at once.
+ */
+void pwm_set_fade(uint16_t duration_ms) {
+	fade_duration = duration_ms;
+	frame_changed = true;
+}
+
+/*
+ * Stops the running fade, if any. The channels keep the values of its
+ * last step.
+ */
+static void stop_fade() {
+	interrupts_off();
+	fade_steps = 0;
+	update_interrupt();
+	interrupts_on();
+}
+
+/*
+ * Starts fading from the values shown now to the given ones over the
+ * given number of PWM periods.
+ */
+static void start_fade(const uint16_t *values, uint32_t steps) {
+	for (int i = 0; i < MODULE_LENGTH; i++) {
+		fade_from[i] = pwm_shown[i];
+		fade_to[i] = values[i];
+	}
+	fade_step = 0;
+
+	interrupts_off();
+	fade_steps = steps;
+	update_interrupt();
+	interrupts_on();
+}
+
+/*
+ * Writes the given values to the CCRx so that all timers latch them
+ * at the same overflow.
+ */
+static void write_channels(const uint16_t *values) {
+	pwm_hal_hold();
+
+	align_channels();
+
+	for (int i = 0; i < MODULE_LENGTH; i++) {
+		show_level(i, derate(i, (uint32_t) values[i] << 16));
+		pwm_shown[i] = values[i];
+	}
+
+	interrupts_off();
+	pwm_hal_release();
+	update_interrupt();
+	interrupts_on();
+}
+
+/*
+ * Sends the given values to the hardware PWM registers, or starts to
+ * fade to them for the given duration in ms if it is not 0. changed tells whether the
+ * values or the fade duration were set since the last frame.
+ *
+ * The CCRx are preloaded, and update events are disabled while they
+ * are written, so the new frame is latched by all timers at once at
+ * the next overflow, within one PWM period.
+ *
+ * A running fade is only stopped if something changed since it was
+ * started, so strobes meant for other boards don't cut it short.
+ */
+static void show_frame(const uint16_t *values, uint16_t duration, bool changed) {
+	if (!changed && fade_steps != 0) {
+		return;
+	}
+
+	stop_fade();
+
+	if (duration != 0) {
+		uint32_t steps = (uint32_t) duration * (PWM_CLOCK / 1000) / (PWM_RELOAD + 1);
+
+		if (steps > PWM_FADE_MAX_STEPS) {
+			steps = PWM_FADE_MAX_STEPS;
+		}
+		if (steps > 1) {
+			start_fade(values, steps);
+			return;
+		}
+	}
+
+	write_channels(values);
+}
+
 /*
  * Sends the status of all PWM channels to the hardware PWM registers.
  *
+ * If pwm_set_fade was called before, the channels fade to the new
+ * values instead.
+ *
  * Returns an error/success code.
  */
 error_t pwm_send_frame() {
+	trace_begin(TRACE_SEND_FRAME);
+	show_frame(pwm_values, fade_duration, frame_changed);
+	trace_end(TRACE_SEND_FRAME);
+
+	frame_changed = false;
+	fade_duration = 0;
+
+	return E_SUCCESS;
+}
+
+/*
+ * Shows the oldest scheduled frame and removes it from the schedule.
+ */
+static void show_scheduled_frame() {
+	scheduled_frame_t *frame = &schedule[schedule_start];
+
+	trace_begin(TRACE_SEND_FRAME);
+	show_frame(frame->values, frame->fade_duration, frame->changed);
+	trace_end(TRACE_SEND_FRAME);
+
+	schedule_start = (schedule_start + 1) % PWM_SCHEDULE_LEN;
+	schedule_count--;
+}
+
+/*
+ * Schedules the status of all PWM channels to be sent to the hardware
+ * PWM registers once the board time reaches the given time. The
+ * values are copied, so the next frame can be set up right away.
+ *
+ * If the schedule is full, the oldest frame is shown at once to make
+ * room.
+ *
+ * Returns an error/success code.
+ */
+error_t pwm_send_frame_at(uint32_t time) {
+	if (schedule_count == PWM_SCHEDULE_LEN) {
+		show_scheduled_frame();
+	}
+
+	scheduled_frame_t *frame =
+		&schedule[(schedule_start + schedule_count) % PWM_SCHEDULE_LEN];
+
+	frame->time = time;
+	frame->fade_duration = fade_duration;
+	frame->changed = frame_changed;
 	for (int i = 0; i < MODULE_LENGTH; i++) {
-		*TIMER_CHANNELS[i] = pwm_values[i];
+		frame->values[i] = pwm_values[i];
 	}
+	schedule_count++;
+
+	frame_changed = false;
+	fade_duration = 0;
 
 	return E_SUCCESS;
 }
+
+/*
+ * Shows the scheduled frames that are due at the given board time.
+ * Times are compared modulo 2^32, so a frame is due if it was
+ * scheduled for at most 2^31ms ago.
+ */
+void pwm_tick(uint32_t now) {
+	while (schedule_count != 0 &&
+	       (int32_t) (now - schedule[schedule_start].time) >= 0) {
+		show_scheduled_frame();
+	}
+}
+
+/*
+ * Sets the factors the channels are scaled with to keep the board
+ * cool, in 1/PWM_FULL_OUTPUT. The channels change at the next PWM
+ * period.
+ */
+void pwm_set_derating(const uint32_t factors[]) {
+	bool changed = false;
+
+	for (int i = 0; i < MODULE_LENGTH; i++) {
+		if (pwm_derating[i] != factors[i]) {
+			pwm_derating[i] = factors[i];
+			changed = true;
+		}
+	}
+
+	// A running fade picks up the new factors with its next step.
+	if (changed && fade_steps == 0) {
+		write_channels(pwm_shown);
+	}
+}
+
+/*
+ * Computes the next step of the running fade.
+ */
+static void fade() {
+	fade_step++;
+
+	// The progress of the fade from 0 to 1 in 16.16 fixed point.
+	// from * (1 - progress) + to * progress fits into 32 bits, and
+	// is the value in 16.16 fixed point.
+	uint32_t progress = (fade_step << 16) / fade_steps;
+
+	for (int i = 0; i < MODULE_LENGTH; i++) {
+		uint32_t value = (uint32_t) fade_from[i] * (0x10000 - progress) +
+			(uint32_t) fade_to[i] * progress;
+		show_level(i, derate(i, value));
+		pwm_shown[i] = value >> 16;
+	}
+
+	if (fade_step == fade_steps) {
+		fade_steps = 0;
+	}
+}
+
+/*
+ * Writes the next CCRx values of the dithered channels.
+ */
+static void dither() {
+	uint16_t active = dither_active;
+
+	for (int i = 0; i < MODULE_LENGTH; i++) {
+		if (!(active & (1 << i))) {
+			continue;
+		}
+
+		uint32_t level = dither_level[i];
+		uint32_t sum = dither_error[i] + (level & DITHER_MASK);
+
+		pwm_hal_write(i, to_ccr(i, (level >> PWM_DITHER_BITS) +
+					(sum >> PWM_DITHER_BITS)));
+		dither_error[i] = sum & DITHER_MASK;
+	}
+}
+
+/*
+ * Called by the update interrupt at the start of each PWM period.
+ * Computes the next step of the running fade and the next values of
+ * the dithered channels.
+ */
+void pwm_period() {
+	// The fade may have been stopped while the interrupt was pending.
+	if (fade_steps != 0) {
+		fade();
+	}
+
+	dither();
+
+	update_interrupt();
+}
@@ -84,11 +84,49 @@ void pwm_set_state(pwm_state_t state);
  */
 error_t pwm_set_brightness(uint8_t led, uint16_t brightness);
 
+/*
+ * Makes the next pwm_send_frame fade to the new values in the given
+ * number of milliseconds instead of showing them at once. The board
+ * computes one step of the fade in each PWM period.
+ */
+void pwm_set_fade(uint16_t duration_ms);
+
 /*
  * Sends the status of all PWM channels to the hardware PWM registers.
+ * All channels switch to the new values together at the end of the
+ * current PWM period, or start to fade there if pwm_set_fade was
+ * called before.
  *
  * Returns an error/success code.
  */
 error_t pwm_send_frame();
 
+/*
+ * Like pwm_send_frame, but the frame is only sent when pwm_tick is
+ * called with the given board time or a later one. Up to
+ * PWM_SCHEDULE_LEN frames can wait to be sent.
+ *
+ * Returns an error/success code.
+ */
+error_t pwm_send_frame_at(uint32_t time);
+
+/*
+ * Sends the frames scheduled with pwm_send_frame_at that are due at
+ * the given board time. This must be called from the main loop at
+ * least once per millisecond.
+ */
+void pwm_tick(uint32_t now);
+
+/*
+ * The derating factor of a channel that is not dimmed.
+ */
+#define PWM_FULL_OUTPUT 0x10000
+
+/*
+ * Sets the factors the PWM channels are scaled with to keep the board
+ * cool, one per channel in 1/PWM_FULL_OUTPUT. This applies to all frames and fades
+ * until it is called again.
+ */
+void pwm_set_derating(const uint32_t factors[]);
+
 #endif
@@ -0,0 +1,233 @@
+#include "pwm_hal.h"
+
+#include "config.h"
+#include "pwm.h"
+#include "sync.h"
+#include "trace.h"
+
+#include "stm_include/stm32/nvic.h"
+#include "stm_include/stm32/timer.h"
+
+/*
+ * Array of all the timer base addresses.
+ */
+#define TIMER_COUNT 6
+static uint32_t TIMERS[TIMER_COUNT] = {
+	TIM1,
+	TIM2,
+	TIM3,
+	TIM15,
+	TIM16,
+	TIM17
+};
+
+/*
+ * Functions to manipulate one register in all the timers. Make sure that the
+ * register in question is available in all timers (see defines in pwm.h).
+ */
+static void set_each(uint32_t reg_offset, int value) {
+	for (int i = 0; i < TIMER_COUNT; i++) {
+		TR(TIMERS[i], reg_offset) = value;
+	}
+}
+
+static void or_each(uint32_t reg_offset, int value) {
+	for (int i = 0; i < TIMER_COUNT; i++) {
+		TR(TIMERS[i], reg_offset) |= value;
+	}
+}
+
+static void and_each(uint32_t reg_offset, int value) {
+	for (int i = 0; i < TIMER_COUNT; i++) {
+		TR(TIMERS[i], reg_offset) &= value;
+	}
+}
+
+/*
+ * Number of timer ticks before an overflow in which pwm_hal_release
+ * does not enable the update events any more, but waits for the
+ * overflow. Enabling them takes a few dozen cycles, and the timers
+ * run at the CPU clock.
+ */
+#define UPDATE_GUARD 128
+
+/*
+ * Sets up the timers in PWM mode 1 with preloaded CCRx and enables the
+ * outputs.
+ */
+void pwm_hal_init() {
+	// Initialize PWM.
+	// Timer configuration should be:
+	// upcounting
+	// ARR = PWM_RELOAD
+	// Send OCxREF to OCx output (CCxE = 1, CCxNE = 0)
+	// PWM mode 1 (mode 2 for the end aligned channels, see
+	// pwm_hal_set_mode)
+	// ARR and CCRx preloaded, so that new values only
+	// take effect on the next update event.
+
+	set_each(CR1, TIM_CR1_CKD_CK_INT | // Dead-time-clock = internal clock
+		 TIM_CR1_CMS_EDGE |        // Edge mode
+		 TIM_CR1_DIR_UP |          // Count up
+		 TIM_CR1_ARPE);            // Preload ARR
+
+
+
+	// Set all outputs to PWM mode 1 with preloaded CCRx.
+	// Cannot use set_each here, because timers have
+	// different numbers of channels.
+	TR(TIM1 , CCMR1) = TIM_CCMR1_OC2M_PWM1 | TIM_CCMR1_OC2PE | TIM_CCMR1_OC1M_PWM1 | TIM_CCMR1_OC1PE;
+	TR(TIM1 , CCMR2) = TIM_CCMR2_OC4M_PWM1 | TIM_CCMR2_OC4PE | TIM_CCMR2_OC3M_PWM1 | TIM_CCMR2_OC3PE;
+	TR(TIM2 , CCMR1) = TIM_CCMR1_OC2M_PWM1 | TIM_CCMR1_OC2PE | TIM_CCMR1_OC1M_PWM1 | TIM_CCMR1_OC1PE;
+	TR(TIM2 , CCMR2) = TIM_CCMR2_OC4M_PWM1 | TIM_CCMR2_OC4PE | TIM_CCMR2_OC3M_PWM1 | TIM_CCMR2_OC3PE;
+	TR(TIM3 , CCMR1) = TIM_CCMR1_OC2M_PWM1 | TIM_CCMR1_OC2PE | TIM_CCMR1_OC1M_PWM1 | TIM_CCMR1_OC1PE;
+	TR(TIM3 , CCMR2) = TIM_CCMR2_OC4M_PWM1 | TIM_CCMR2_OC4PE | TIM_CCMR2_OC3M_PWM1 | TIM_CCMR2_OC3PE;
+	TR(TIM15, CCMR1) = TIM_CCMR1_OC2M_PWM1 | TIM_CCMR1_OC2PE | TIM_CCMR1_OC1M_PWM1 | TIM_CCMR1_OC1PE;
+	TR(TIM16, CCMR1) = TIM_CCMR1_OC1M_PWM1 | TIM_CCMR1_OC1PE;
+	TR(TIM17, CCMR1) = TIM_CCMR1_OC1M_PWM1 | TIM_CCMR1_OC1PE;
+
+	// All timers must overflow at the same time, so that a frame
+	// is latched at once. TIM1 is the master: TIM2 and TIM3 start
+	// when it starts (ITR0 = TIM1), and TIM15 starts with TIM2
+	// (ITR0 = TIM2). TIM16 and TIM17 have no slave mode controller,
+	// they are started together with TIM1 in pwm_hal_start.
+	TR(TIM1 , CR2) = TIM_CR2_MMS_ENABLE;
+	TR(TIM2 , CR2) = TIM_CR2_MMS_ENABLE;
+	TR(TIM2 , SMCR) = TIM_SMCR_TS_ITR0 | TIM_SMCR_SMS_TM;
+	TR(TIM3 , SMCR) = TIM_SMCR_TS_ITR0 | TIM_SMCR_SMS_TM;
+	TR(TIM15, SMCR) = TIM_SMCR_TS_ITR0 | TIM_SMCR_SMS_TM;
+
+	set_each(ARR, PWM_RELOAD);
+
+	// Enable outputs:
+	// 1. Set Main Output Enable (for those timers that have it)
+	TR(TIM1 , BDTR) = TIM_BDTR_MOE;
+	TR(TIM15, BDTR) = TIM_BDTR_MOE;
+	TR(TIM16, BDTR) = TIM_BDTR_MOE;
+	TR(TIM17, BDTR) = TIM_BDTR_MOE;
+	// 2. Enable outputs
+	pwm_hal_outputs(true);
+}
+
+/*
+ * Loads the CCRx and starts the timers.
+ */
+void pwm_hal_start() {
+	// The update interrupt of TIM1 drives the fades and the
+	// dithering. It is only enabled in the timer while it is needed.
+	NVIC_ISER(0) |= (1 << NVIC_TIM1_UP_IRQ);
+
+	// Force the registers to be actually loaded.
+	or_each(EGR, TIM_EGR_UG);
+
+	// Finally enable the timers. The slaves follow TIM1 with a
+	// constant delay of a few cycles; the three stores below are
+	// as close together as we can get.
+	uint32_t cr1_tim16 = TR(TIM16, CR1) | TIM_CR1_CEN;
+	uint32_t cr1_tim17 = TR(TIM17, CR1) | TIM_CR1_CEN;
+	uint32_t cr1_tim1 = TR(TIM1, CR1) | TIM_CR1_CEN;
+	interrupts_off();
+	TR(TIM16, CR1) = cr1_tim16;
+	TR(TIM17, CR1) = cr1_tim17;
+	TR(TIM1, CR1) = cr1_tim1;
+	interrupts_on();
+}
+
+/*
+ * Enables or disables all C/C outputs.
+ */
+void pwm_hal_outputs(bool on) {
+	if (!on) {
+		set_each(CCER, 0);
+		return;
+	}
+
+	// TODO: Can this be written as
+	// 	set_each(CCER, TIM_CCER_CC1E | TIM_CCER_CC2E | TIM_CCER_CC3E | TIM_CCER_CC4E);
+	// or will that produce errors for TIM15-17?
+	// The answer is: It is outside specification and should not be done.
+
+	// Note inverted channels in TIM1!
+	TR(TIM1 , CCER) = TIM_CCER_CC1NE | TIM_CCER_CC2NE | TIM_CCER_CC3NE | TIM_CCER_CC4E;
+	TR(TIM2 , CCER) = TIM_CCER_CC1E | TIM_CCER_CC2E | TIM_CCER_CC3E | TIM_CCER_CC4E;
+	TR(TIM3 , CCER) = TIM_CCER_CC1E | TIM_CCER_CC2E | TIM_CCER_CC3E | TIM_CCER_CC4E;
+	TR(TIM15, CCER) = TIM_CCER_CC1E | TIM_CCER_CC2E;
+	TR(TIM16, CCER) = TIM_CCER_CC1E;
+	TR(TIM17, CCER) = TIM_CCER_CC1E;
+}
+
+/*
+ * Switches the given channel between PWM mode 1 and 2.
+ */
+void pwm_hal_set_mode(int channel, bool end_aligned) {
+	// The registers of each timer are in a block of 0x400 bytes.
+	// CCR1-2 have their modes in CCMR1, CCR3-4 in CCMR2, the even
+	// ones in the upper half.
+	uint32_t ccr = (uint32_t) TIMER_CHANNELS[channel];
+	uint32_t timer = ccr & ~0x3ff;
+	uint32_t index = ((ccr & 0x3ff) - CCR1) / 4;
+	uint32_t ccmr = index < 2 ? CCMR1 : CCMR2;
+	uint32_t mask, mode;
+
+	if (index % 2 == 0) {
+		mask = TIM_CCMR1_OC1M_MASK;
+		mode = end_aligned ? TIM_CCMR1_OC1M_PWM2 : TIM_CCMR1_OC1M_PWM1;
+	} else {
+		mask = TIM_CCMR1_OC2M_MASK;
+		mode = end_aligned ? TIM_CCMR1_OC2M_PWM2 : TIM_CCMR1_OC2M_PWM1;
+	}
+
+	TR(timer, ccmr) = (TR(timer, ccmr) & ~mask) | mode;
+}
+
+/*
+ * Writes the CCRx of the given channel.
+ */
+void pwm_hal_write(int channel, uint16_t ccr) {
+	*TIMER_CHANNELS[channel] = ccr;
+}
+
+/*
+ * Disables the update events of all timers.
+ */
+void pwm_hal_hold() {
+	or_each(CR1, TIM_CR1_UDIS);
+}
+
+/*
+ * Enables the update events of all timers again.
+ */
+void pwm_hal_release() {
+	// If the timers overflowed while we enable the update events, some
+	// of them would latch the frame a period later than the others.
+	// So wait for the overflow if it is close.
+	while (TR(TIM1, CNT) > PWM_RELOAD - UPDATE_GUARD);
+	and_each(CR1, ~TIM_CR1_UDIS);
+}
+
+/*
+ * Enables or disables the update interrupt of TIM1.
+ */
+void pwm_hal_update_interrupt(bool enabled) {
+	if (enabled) {
+		if (!(TR(TIM1, DIER) & TIM_DIER_UIE)) {
+			TR(TIM1, SR) = ~TIM_SR_UIF;
+			TR(TIM1, DIER) |= TIM_DIER_UIE;
+		}
+	} else {
+		TR(TIM1, DIER) &= ~TIM_DIER_UIE;
+	}
+}
+
+/*
+ * ISR for the update event of TIM1, which is at the start of each
+ * PWM period. The values are written right after an overflow, so all
+ * timers latch them together at the next one.
+ */
+void __attribute__ ((interrupt("IRQ"))) isr_tim1_up() {
+	TR(TIM1, SR) = ~TIM_SR_UIF;
+
+	trace_begin(TRACE_PWM_ISR);
+	pwm_period();
+	trace_end(TRACE_PWM_ISR);
+}
@@ -0,0 +1,77 @@
+#ifndef PWM_HAL_H
+#define PWM_HAL_H
+
+/*
+ * The hardware side of the PWM: the timers that drive the channels.
+ * The frames, fades, dithering and derating in pwm.c only go through
+ * these functions. A host build provides its own version of them (see
+ * host/).
+ *
+ * Each channel has a CCRx, which is preloaded: a value written to it
+ * only takes effect at the next overflow of the timers, which starts
+ * a new PWM period.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Sets up the timers in PWM mode 1 with preloaded CCRx and enables the
+ * outputs. The timers don't count until pwm_hal_start is called.
+ */
+void pwm_hal_init();
+
+/*
+ * Loads the CCRx written so far and starts the timers, all at once.
+ */
+void pwm_hal_start();
+
+/*
+ * Enables or disables the outputs of all channels. This takes effect
+ * at once.
+ */
+void pwm_hal_outputs(bool on);
+
+/*
+ * Switches the given channel to PWM mode 2 if end_aligned is set, and
+ * to PWM mode 1 otherwise. Update events must be disabled (see
+ * pwm_hal_hold).
+ */
+void pwm_hal_set_mode(int channel, bool end_aligned);
+
+/*
+ * Writes the given value to the CCRx of the given channel.
+ */
+void pwm_hal_write(int channel, uint16_t ccr);
+
+/*
+ * Disables the update events, so that the timers keep the values they
+ * have until pwm_hal_release is called.
+ */
+void pwm_hal_hold();
+
+/*
+ * Enables the update events again, so that all timers load the CCRx
+ * written since pwm_hal_hold at the same overflow. Interrupts must be
+ * off.
+ */
+void pwm_hal_release();
+
+/*
+ * Enables or disables the update interrupt, which calls pwm_period at
+ * the start of each PWM period. Interrupts must be off.
+ */
+void pwm_hal_update_interrupt(bool enabled);
+
+/*
+ * Computes the CCRx values for the next PWM period. This is in pwm.c
+ * and called by the update interrupt.
+ */
+void pwm_period();
+
+/*
+ * ISR for the update event of TIM1.
+ */
+void isr_tim1_up();
+
+#endif
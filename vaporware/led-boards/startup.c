@@ -3,9 +3,11 @@
 #include "error.h"
 #include "heat.h"
 #include "pwm.h"
+#include "pwm_hal.h"
 #include "main.h"
 #include "usart1.h"
 #include "usart2.h"
+#include "usart2_hal.h"
 
 #include "stm_include/stm32/rcc.h"
 #include "stm_include/stm32/gpio.h"
@@ -68,7 +70,7 @@ void (*volatile interrupts[])() __attribute__ ((section (".isr_vector"))) = {
 	unexpected_interrupt, /* 0x0074: DMA1 channel 3 */
 	unexpected_interrupt, /* 0x0078: DMA1 channel 4 */
 	unexpected_interrupt, /* 0x007c: DMA1 channel 5 */
-	unexpected_interrupt, /* 0x0080: DMA1 channel 6 */
+	isr_dma1_channel6, /* 0x0080: DMA1 channel 6 */
 	unexpected_interrupt, /* 0x0084: DMA1 channel 7 */
 	ignore, /* 0x0088: ADC1 */
 	unexpected_interrupt, /* 0x008c: unused */
@@ -77,7 +79,7 @@ void (*volatile interrupts[])() __attribute__ ((section (".isr_vector"))) = {
 	unexpected_interrupt, /* 0x0098: unused */
 	unexpected_interrupt, /* 0x009c: unused */
 	unexpected_interrupt, /* 0x00a0: unused */
-	unexpected_interrupt, /* 0x00a4: unused */
+	isr_tim1_up, /* 0x00a4: TIM1 update */
 	unexpected_interrupt, /* 0x00a8: unused */
 	unexpected_interrupt, /* 0x00ac: unused */
 	unexpected_interrupt, /* 0x00b0: unused */
@@ -162,16 +164,18 @@ static inline void clock_init() {
 
 	// Enable peripherals
 	//  - Power interface
+	//  - Backup registers
 	//  - USART 2
 	//  - Timers (3, 2)
 	RCC_APB1ENR |= RCC_APB1ENR_PWREN |
+		RCC_APB1ENR_BKPEN |
 		RCC_APB1ENR_USART2EN |
 		RCC_APB1ENR_TIM3EN |
 		RCC_APB1ENR_TIM2EN;
 
-	// Set systick timer to 0.1s
-	// Divisor of 299999 at 3MHz
-	STK_LOAD = 299999;
+	// Set systick timer to 1ms
+	// Divisor of 2999 at 3MHz
+	STK_LOAD = 2999;
 
 	// Systick will be enabled when the heat check is initialized.
 }
@@ -201,6 +205,10 @@ static void remap_init() {
 		(GPIO_CNF_OUTPUT_ALTFN_PUSHPULL << 14) |    // TIM1_CH4
 		(GPIO_MODE_OUTPUT_10_MHZ << 12);
 
+	// Pull USART1_RX up, so that it is only low at startup if the
+	// config mode strap is set (see console_config_requested).
+	GPIOA_ODR |= GPIO10;
+
 	GPIOB_CRL = (GPIO_CNF_OUTPUT_ALTFN_PUSHPULL << 2) | // TIM1_CH2N
 		(GPIO_MODE_OUTPUT_10_MHZ << 0) |
 		(GPIO_CNF_OUTPUT_ALTFN_PUSHPULL << 6) |     // TIM1_CH3N
@@ -286,10 +294,24 @@ void startup() {
 }
 
 /*
- * Interrupt handler for the systick. This calls the heat checking function
- * from time to time.
+ * Interrupt handler for the systick. This counts the board time, parses
+ * the bus traffic and calls the heat checking function from time to
+ * time.
  */
 void __attribute__ ((interrupt("IRQ"))) systick() {
+	static unsigned int heat_check_countdown = TICKS_PER_HEAT_CHECK;
+
+	board_time++;
+
+	// Commands in continuous traffic shouldn't wait for the next
+	// half of the receive ring.
+	usart2_parse();
+
+	if (--heat_check_countdown != 0) {
+		return;
+	}
+	heat_check_countdown = TICKS_PER_HEAT_CHECK;
+
 #ifndef OMIT_HEAT_CHECK
 	if (do_heat_check) {
 		// There has been no heat check since last time the
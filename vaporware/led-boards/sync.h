@@ -3,6 +3,11 @@
  */
 #define atomic_increment(ptr) __sync_fetch_and_add(ptr, 1)
 
+/*
+ * Adds value to the value pointed to by ptr atomically.
+ */
+#define atomic_add(ptr, value) __sync_fetch_and_add(ptr, value)
+
 /*
  * Decrements the value pointed to by ptr atomically.
  */
@@ -20,6 +25,8 @@
  */
 #define atomic_reset(ptr) __sync_fetch_and_and(ptr, 0)
 
+#ifdef __arm__
+
 /*
  * Suspends interrupts.
  */
@@ -29,3 +36,14 @@
  * Resume interrupts.
  */
 #define interrupts_on() __asm("cpsie i" : : : "memory")
+
+#else
+
+/*
+ * A host build (see host/) runs the interrupt handlers from the main
+ * loop, so there is nothing to suspend.
+ */
+#define interrupts_off()
+#define interrupts_on()
+
+#endif
@@ -0,0 +1,148 @@
+#include "trace.h"
+
+#ifdef TRACE_CYCLES
+
+#include "config.h"
+#include "console.h"
+#include "debug.h"
+#include "sync.h"
+#include "term.h"
+
+/*
+ * One recorded event.
+ */
+typedef struct {
+	uint32_t cycles;
+	uint8_t point;
+	bool end;
+} trace_event_t;
+
+static trace_event_t trace_ring[TRACE_RING_LEN];
+
+/*
+ * Total number of events recorded since the trace was cleared. The
+ * newest event is at (trace_count - 1) % TRACE_RING_LEN.
+ */
+static volatile uint32_t trace_count = 0;
+
+static volatile bool trace_paused = false;
+
+static const char *TRACE_POINT_NAMES[TRACE_POINT_COUNT] = {
+	[TRACE_USART_ISR]  = "usart isr ",
+	[TRACE_PARSE]      = "parse     ",
+	[TRACE_COMMAND]    = "command   ",
+	[TRACE_COLOR]      = "color     ",
+	[TRACE_SEND_FRAME] = "send frame",
+	[TRACE_PWM_ISR]    = "pwm isr   ",
+};
+
+/*
+ * Starts the cycle counter and clears the trace.
+ */
+void trace_init() {
+	// The counter runs freely from now on, nothing else may restart it.
+	cycle_start();
+	trace_count = 0;
+}
+
+/*
+ * Records the beginning or end of an instrumented place.
+ */
+void trace_event(trace_point_t point, bool end) {
+	if (trace_paused) {
+		return;
+	}
+
+	// An ISR may record an event in between, so claim the slot
+	// atomically.
+	uint32_t slot = atomic_increment(&trace_count) % TRACE_RING_LEN;
+
+	trace_ring[slot].cycles = cycle_get();
+	trace_ring[slot].point = point;
+	trace_ring[slot].end = end;
+}
+
+/*
+ * Sorts the given array in place (it is short).
+ */
+static void sort(uint32_t *values, int count) {
+	for (int i = 1; i < count; i++) {
+		uint32_t value = values[i];
+		int j;
+		for (j = i; j > 0 && values[j-1] > value; j--) {
+			values[j] = values[j-1];
+		}
+		values[j] = value;
+	}
+}
+
+/*
+ * Prints the given percentile of the sorted values.
+ */
+static void print_percentile(const uint32_t *sorted, int count, int percent) {
+	console_write("  ");
+	console_uint(sorted[(count - 1) * percent / 100], 10, 7, ' ');
+}
+
+/*
+ * Prints the recorded events and percentiles of the cycles spent in
+ * each place. Places interrupted by an ISR include its cycles.
+ */
+void trace_dump() {
+	trace_paused = true;
+
+	uint32_t count = trace_count;
+	uint32_t first = count > TRACE_RING_LEN ? count - TRACE_RING_LEN : 0;
+
+	console_write("Trace (cycle, place, b/e):" CRLF);
+	for (uint32_t e = first; e != count; e++) {
+		trace_event_t *event = &trace_ring[e % TRACE_RING_LEN];
+
+		console_uint(event->cycles, 10, 10, ' ');
+		console_write("  ");
+		console_write(TRACE_POINT_NAMES[event->point]);
+		console_write(event->end ? "  e" CRLF : "  b" CRLF);
+	}
+
+	console_write(CRLF "place       count      min      p50      p90      p99      max" CRLF);
+	for (int point = 0; point < TRACE_POINT_COUNT; point++) {
+		uint32_t durations[TRACE_RING_LEN / 2];
+		int n = 0;
+		bool begun = false;
+		uint32_t begin = 0;
+
+		for (uint32_t e = first; e != count; e++) {
+			trace_event_t *event = &trace_ring[e % TRACE_RING_LEN];
+
+			if (event->point != point) {
+				continue;
+			}
+			if (!event->end) {
+				begun = true;
+				begin = event->cycles;
+			} else if (begun) {
+				durations[n++] = event->cycles - begin;
+				begun = false;
+			}
+		}
+
+		if (n == 0) {
+			continue;
+		}
+		sort(durations, n);
+
+		console_write(TRACE_POINT_NAMES[point]);
+		console_uint(n, 10, 7, ' ');
+		print_percentile(durations, n, 0);
+		print_percentile(durations, n, 50);
+		print_percentile(durations, n, 90);
+		print_percentile(durations, n, 99);
+		print_percentile(durations, n, 100);
+		console_write(CRLF);
+	}
+
+	trace_count = 0;
+	trace_paused = false;
+}
+
+#endif
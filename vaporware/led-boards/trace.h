@@ -0,0 +1,61 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/*
+ * Cycle tracing. When compiled with TRACE_CYCLES, the instrumented
+ * places record the cycle counter when they begin and end into a ring
+ * buffer in RAM, which can be dumped on the console with trace_dump.
+ * Recording an event takes a few cycles and prints nothing, so all
+ * places can be traced at once. Without TRACE_CYCLES, the trace_*
+ * macros compile to nothing.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * The instrumented places.
+ */
+typedef enum {
+	TRACE_USART_ISR,  // isr_usart2 and isr_dma1_channel6
+	TRACE_PARSE,      // usart2_parse
+	TRACE_COMMAND,    // run_command
+	TRACE_COLOR,      // color_correct
+	TRACE_SEND_FRAME, // pwm_send_frame and scheduled frames
+	TRACE_PWM_ISR,    // isr_tim1_up (fades and dithering)
+
+	TRACE_POINT_COUNT
+} trace_point_t;
+
+#ifdef TRACE_CYCLES
+
+/*
+ * Starts the cycle counter and clears the trace.
+ */
+void trace_init();
+
+/*
+ * Records the beginning or end of an instrumented place. This may be
+ * called from ISRs.
+ */
+void trace_event(trace_point_t point, bool end);
+
+#define trace_begin(point) trace_event((point), false)
+#define trace_end(point) trace_event((point), true)
+
+/*
+ * Prints the recorded events and, for each place, percentiles of the
+ * cycles between its beginning and end on the console. Tracing is
+ * paused while this runs, and the trace is cleared afterwards.
+ */
+void trace_dump();
+
+#else
+
+#define trace_init()
+#define trace_begin(point)
+#define trace_end(point)
+
+#endif
+
+#endif
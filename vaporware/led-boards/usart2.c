@@ -4,17 +4,26 @@
 #include "config.h"
 #include "error.h"
 #include "fail.h"
+#include "main.h"
 #include "sync.h"
+#include "trace.h"
+#include "usart2_hal.h"
 
-#if defined COUNT_USART_ISR || defined TRACE_USART
-	#include "debug.h"
-#endif
-
-#include "stm_include/stm32/nvic.h"
-#include "stm_include/stm32/usart.h"
+/*
+ * The DMA receives the bus traffic into usart2_rx_ring (see
+ * usart2_hal.c). usart2_parse unescapes the bytes and stores the
+ * commands for this board in the command queue. It is called from the
+ * USART, DMA and systick interrupts, so traffic for other boards never
+ * piles up while the main loop is busy. The main loop takes the
+ * commands from the queue with usart2_next_command and runs them in
+ * place.
+ *
+ * Nothing in here touches the hardware, so the parser can also be
+ * built for a host (see host/).
+ */
 
 /*
- * The possible states that the USART ISR can be in.
+ * The possible states of the command parser.
  */
 typedef enum {
 	// The USART is not currently reading a command.
@@ -26,7 +35,18 @@ typedef enum {
 	// A address byte this module listenes to has been
 	// received. The command is now read.
 	READING,
-} isr_state_t;
+} rx_state_t;
+
+/*
+ * Where a queued command is stored in cmd_ring.
+ */
+typedef struct {
+	uint16_t start;
+	uint8_t length;
+	// The low bits of the board time when the command was complete.
+	// No command waits in the queue for a minute, so they are enough.
+	uint16_t received_at;
+} frame_t;
 
 /*
  * The currently set address filter for USART commands.
@@ -39,153 +59,160 @@ static usart_address_filter_t address_filter;
 static usart_length_check_t length_check;
 
 /*
- * Shared between ISR and usart_next_command.
- * Remember to synchronize!
+ * The command queue. The commands are stored one after the other in
+ * cmd_ring, which is the RAM left over by everything else (see
+ * usart2_cmd_memory). A command never wraps around the end of the
+ * ring, so it can be run in place; if it might not fit there, it is
+ * stored at the beginning. frames describes the queued commands, the
+ * oldest at read_frame.
  *
- * commands_pending is incremented by the ISR when a command has been fully
- * received and stored. If usart_next_command finds commands_pending to be
- * greater than 0, a command is available at *read_buffer. After processing
- * this command, usart_next_command advances read_buffer by one buffer and
- * decrements commands_pending. If commands_pending equals USART_BUFFER_COUNT,
- * the ISR may not store another command (the command will be dropped), because
- * all buffers already contain a command to be read by usart_next_command.
- */
-static volatile int commands_pending = 0;
-
-/*
- * Also shared between ISR and usart_next_command.
+ * Shared between the parser and usart2_next_command.
+ * Remember to synchronize!
  *
- * This is set by the ISR to indicate that a command could not be stored because
- * no command buffer was free. It is checked by the next call to
- * usart_next_command and an error message is sent when overflow has occurred.
+ * frames_pending is incremented by the parser when a command has been
+ * fully received and stored. After running the command it returned,
+ * usart2_next_command advances read_frame and only then decrements
+ * frames_pending, so the parser never overwrites a command that is
+ * still queued or running. If there is no room for another command,
+ * the parser drops it and sets command_overflow, which is reported by
+ * the next call to usart2_next_command.
  */
+static unsigned char *cmd_ring = (unsigned char*) 0;
+static uint32_t cmd_ring_len;
+static volatile frame_t frames[CMD_FRAME_COUNT];
+static volatile int read_frame = 0;
+static volatile int frames_pending = 0;
 static volatile int command_overflow = 0;
 
-// A ring buffer for concurrent read and write.
-static unsigned char isr_buffers[USART_BUFFER_COUNT][CMD_BUFFER_LEN];
-
-// The buffer currently read from.
-static int read_buffer = 0;
-
-// 1, if the "outside" is currently reading from read_buffer.
+// 1, if the main loop is running the command at read_frame.
 static int is_reading = 0;
 
 /*
- * Variables only to be used by the ISR and helper functions.
+ * Variables only to be used by the parser.
  */
-// Current state of the receiving USART.
-static isr_state_t isr_state = IDLE;
+// Current state of the parser.
+static rx_state_t rx_state = IDLE;
 // 1, if the last character was ESCAPE_MARK
-static int isr_escape = 0;
-// The buffer currently used for writing.
-static int isr_write_buffer = 0;
-// Index into the writing buffer, points to first free space.
-static int isr_write_idx = 0;
+static int rx_escape = 0;
+// Total number of bytes parsed so far.
+static uint32_t rx_consumed = 0;
+// Number of reception errors when the parser last looked.
+static uint32_t rx_errors_seen = 0;
+// Where the command currently assembled starts in cmd_ring.
+static uint32_t rx_write_start = 0;
+// Index into the command currently assembled, points to first free space.
+static int rx_write_idx = 0;
 // Total number of bytes remaining until the next length check.
-static int isr_bytes_remaining = 0;
+static int rx_bytes_remaining = 0;
+// Number of bytes to drop before storing the remaining ones.
+static int rx_bytes_skip = 0;
+// The frame the next command is described in.
+static int write_frame = 0;
+// The first byte after the newest command in cmd_ring.
+static uint32_t write_pos = 0;
 // USART failure counter.
-static fail_t isr_usart_fails;
+static fail_t usart_fails;
+// Traffic counters. Bytes and errors are counted by the HAL.
+static usart_stats_t stats;
 
 /*
  * Initializes the RS485 bus USART. This must be called before any other
  * function accessing the USART.
  */
 void usart2_init() {
-	fail_init(&isr_usart_fails, USART_FAIL_TRESHOLD);
+	fail_init(&usart_fails, USART_FAIL_TRESHOLD);
 
-	USART2_BRR = USART_BAUD_VALUE;
+	usart2_hal_init();
 
-	USART2_CR1 = USART_CR1_UE |
-		USART_CR1_RXNEIE |
-		USART_CR1_RE;
+	// This enables the parser.
+	cmd_ring = usart2_cmd_memory(&cmd_ring_len);
+}
+
+/*
+ * Handles an error on the USART by discarding the unfinished command and
+ * recording the failure.
+ */
+static void read_error() {
+	// Abort current reception
+	rx_write_idx = 0;
+	rx_state = IDLE;
 
-	NVIC_ISER(1) |= (1 << (NVIC_USART2_IRQ - 32));
+	if (fail_event(&usart_fails, 1)) {
+		// Too many failures, raise an error.
+		error(ER_USART_RX, STR_WITH_LEN("Too many USART errors"), EA_PANIC);
+	}
 }
 
 /*
- * Returns a pointer to a buffer containing the next available USART command that
- * the current filter is interested in.
- * If no command is available, returns NULL.
+ * Finds room for a command of up to CMD_BUFFER_LEN bytes in cmd_ring
+ * and stores where it starts in rx_write_start. Returns 0 if the queue
+ * is full.
  */
-unsigned char *usart2_next_command() {
-	// 1. Free the last command if it was being read from.
-	if (is_reading) {
-		interrupts_off();
-		if (read_buffer == USART_BUFFER_COUNT - 1) {
-			read_buffer = 0;
-		} else {
-			read_buffer++;
-		}
-		atomic_decrement(&commands_pending);
+static int reserve_command() {
+	int pending = frames_pending;
 
-		is_reading = 0;
-		interrupts_on();
+	if (pending == CMD_FRAME_COUNT) {
+		return 0;
 	}
 
-	// 2. Check if an overflow needs to be reported.
-	if (command_overflow) {
-		error(ER_CMDOVERFLOW, STR_WITH_LEN("CO"), EA_RESUME);
-		atomic_reset(&command_overflow);
+	if (pending == 0) {
+		// Nothing is queued, start over.
+		rx_write_start = 0;
+		return 1;
 	}
 
-	// 3. Check if there is a new command.
-	// Note that this section need not be atomic, because even if
-	// an interrupt occurs here, it can only append to the
-	// command buffer and never overwrite an existing command.
-	if (commands_pending > 0) {
-		is_reading = 1;
-		return &(isr_buffers[read_buffer][0]);
+	uint32_t oldest = frames[read_frame].start;
+
+	if (write_pos >= oldest) {
+		// The queued commands don't wrap around, so there is room
+		// after the newest and before the oldest one.
+		if (write_pos + CMD_BUFFER_LEN <= cmd_ring_len) {
+			rx_write_start = write_pos;
+			return 1;
+		}
+		if (CMD_BUFFER_LEN < oldest) {
+			rx_write_start = 0;
+			return 1;
+		}
 	} else {
-		return (unsigned char*) 0;
+		// Only between the newest and the oldest one. This must
+		// never fill up completely, or it would look like the case
+		// above.
+		if (write_pos + CMD_BUFFER_LEN < oldest) {
+			rx_write_start = write_pos;
+			return 1;
+		}
 	}
-}
-
-/*
- * Sets a command filter function for USART reception.
- * The filter gets passed a USART command and must return a nonzero value
- * to indicate interest in the command.
- */
-void usart2_set_address_filter(usart_address_filter_t filter) {
-	address_filter = filter;
-}
 
-/*
- * Sets a length check function for USART reception.
- */
-void usart2_set_length_check(usart_length_check_t check) {
-	length_check = check;
+	return 0;
 }
 
 /*
- * Functions for the ISR (and the ISR itself).
- */
-
-/*
- * Handles an error on the USART by discarding the unfinished command and
- * recording the failure.
+ * Appends the command just assembled to the queue.
  */
-static void isr_read_error() {
-	// Abort current reception
-	isr_write_idx = 0;
-	isr_state = IDLE;
-
-	if (fail_event(&isr_usart_fails, 1)) {
-		// Too many failures, raise an error.
-		error(ER_USART_RX, STR_WITH_LEN("Too many USART errors"), EA_PANIC);
+static void queue_command() {
+	frames[write_frame].start = rx_write_start;
+	frames[write_frame].length = rx_write_idx;
+	frames[write_frame].received_at = board_time;
+	write_frame = (write_frame + 1) % CMD_FRAME_COUNT;
+	write_pos = rx_write_start + rx_write_idx;
+
+	int pending = atomic_increment(&frames_pending) + 1;
+	if ((uint32_t) pending > stats.max_queued) {
+		stats.max_queued = pending;
 	}
 }
 
 /*
- * Adds the given byte to the command that is currently assembled. If
- * the byte finishes a command, the command is made available to
- * usart_next_command.
+ * Adds the given byte to the command that is currently assembled.
+ * Returns 1 if the byte finishes a command.
  */
-static void isr_read_command(unsigned char in_byte) {
+static int read_command(unsigned char in_byte) {
 
 	// If the last character was ESCAPE_MARK, we now need
 	// to evaluate the escape sequence.
-	if (isr_escape) {
-		isr_escape = 0;
+	if (rx_escape) {
+		rx_escape = 0;
 
 		switch (in_byte) {
 		case 0x00:
@@ -196,28 +223,28 @@ static void isr_read_command(unsigned char in_byte) {
 			break;
 		default:
 			// Bad escape sequence
-			isr_read_error();
-			return;
+			read_error();
+			return 0;
 			break;
 		}
 	} else {
 		// If ESCAPE_MARK is received, it must be dropped and
-		// only isr_escape set.
+		// only rx_escape set.
 		if (in_byte == ESCAPE_MARK) {
-			isr_escape = 1;
-			return;
+			rx_escape = 1;
+			return 0;
 		}
 
 		// Whatever the state is, on receiving the start-of-command
 		// mark we must abort the current command and go into
 		// the GOT_START state.
 		if (in_byte == START_MARK) {
-			isr_state = GOT_START;
-			return;
+			rx_state = GOT_START;
+			return 0;
 		}
 	}
 
-	switch(isr_state) {
+	switch(rx_state) {
 	case IDLE:
 		// Nothing to do. The code above takes care of
 		// receiving the start byte.
@@ -226,87 +253,205 @@ static void isr_read_command(unsigned char in_byte) {
 	case GOT_START:
 		// This byte (the one after start) is the destination address.
 		// Check if we are listening to it.
-		if (address_filter(in_byte)) {
-			// Check for space in the command buffers.
-			if (commands_pending >= USART_BUFFER_COUNT) {
-				// There are no free command buffers,
-				// this command must be dropped.
-				atomic_set(&command_overflow);
-				isr_state = IDLE;
-				return;
-			}
+		stats.frames++;
+		if (!address_filter(in_byte)) {
+			rx_state = IDLE;
+			break;
+		}
+		stats.frames_accepted++;
 
-			isr_write_idx = 0;
-			isr_bytes_remaining = 1;
+		if (!reserve_command()) {
+			// The main loop is too slow, drop the command.
+			stats.dropped_commands++;
+			atomic_set(&command_overflow);
+			rx_state = IDLE;
+			break;
+		}
 
-			isr_state = READING;
+		rx_write_idx = 0;
+		rx_bytes_remaining = 1;
+		rx_bytes_skip = 0;
 
-		} else {
-			isr_state = IDLE;
-		}
+		rx_state = READING;
 		break;
 
 	case READING:
+		if (rx_bytes_skip > 0) {
+			rx_bytes_skip--;
+			break;
+		}
+
+		if (rx_write_idx >= CMD_BUFFER_LEN) {
+			// The length check should not allow this.
+			read_error();
+			return 0;
+		}
+
 		// Store the next byte.
-		isr_buffers[isr_write_buffer][isr_write_idx++] = in_byte & 0xff;
-		isr_bytes_remaining--;
+		cmd_ring[rx_write_start + rx_write_idx++] = in_byte & 0xff;
+		rx_bytes_remaining--;
+
+		if (rx_bytes_remaining <= 0) {
+			rx_bytes_remaining = length_check(cmd_ring + rx_write_start,
+							  rx_write_idx, &rx_bytes_skip);
+		}
 
-		if (isr_bytes_remaining <= 0) {
-			isr_bytes_remaining = length_check(isr_buffers[isr_write_buffer], isr_write_idx);
+		if (rx_bytes_remaining == USART_DROP_COMMAND) {
+			// Nothing for us in there. The reserved space is
+			// simply reused by the next command.
+			rx_state = IDLE;
+			break;
 		}
 
-		if (isr_bytes_remaining <= 0) {
-			atomic_increment(&commands_pending);
-			// Allocate a new buffer.
-			if (isr_write_buffer == USART_BUFFER_COUNT - 1) {
-				isr_write_buffer = 0;
-			} else {
-				isr_write_buffer++;
-			}
-			isr_state = IDLE;
+		if (rx_bytes_remaining <= 0) {
+			rx_state = IDLE;
+			return 1;
 		}
 
 		break;
 
 	default:
-		error(ER_BUG, STR_WITH_LEN("isr_read_command: Corrupt isr_state"),
+		error(ER_BUG, STR_WITH_LEN("read_command: Corrupt rx_state"),
 		      EA_PANIC);
 	}
+
+	return 0;
+}
+
+/*
+ * Parses the bytes received since the last call and queues the
+ * commands the current filter is interested in.
+ */
+void usart2_parse() {
+	if (!cmd_ring) {
+		// Not initialized yet (the systick calls this from startup on).
+		return;
+	}
+
+	uint32_t produced = usart2_rx_produced();
+	uint32_t backlog = produced - rx_consumed;
+
+	// 1. Check if the DMA has overwritten bytes we did not parse yet.
+	if (backlog > USART_RX_RING_LEN) {
+		stats.overflows++;
+		stats.dropped_bytes += backlog;
+		backlog = USART_RX_RING_LEN;
+
+		atomic_set(&command_overflow);
+		rx_consumed = produced;
+		rx_escape = 0;
+		rx_state = IDLE;
+	}
+
+	if (backlog > stats.max_backlog) {
+		stats.max_backlog = backlog;
+	}
+
+	if (rx_consumed == produced) {
+		return;
+	}
+
+	trace_begin(TRACE_PARSE);
+
+	// 2. Parse everything that has arrived.
+	while (rx_consumed != produced) {
+		// Errors abort the command that was received with them.
+		uint32_t error_at;
+		uint32_t errors = usart2_rx_errors(&error_at);
+		if (errors != rx_errors_seen &&
+		    (int32_t) (rx_consumed - error_at) >= 0) {
+			rx_errors_seen = errors;
+			read_error();
+		} else {
+			fail_event(&usart_fails, 0);
+		}
+
+		unsigned char in_byte = usart2_rx_ring[rx_consumed % USART_RX_RING_LEN];
+		rx_consumed++;
+
+		if (read_command(in_byte)) {
+			queue_command();
+		}
+	}
+
+	trace_end(TRACE_PARSE);
 }
 
 /*
- * Dispatches a USART interrupt. Arguments should be the status and
- * data register of the USART which caused the interrupt.
+ * Returns a pointer to the next queued USART command that the current
+ * filter is interested in. The command stays valid until the next call.
+ * If no command is available, returns NULL.
  */
-void isr_dispatch(unsigned short sr, unsigned short dr) {
-	// First, check for errors.
-	if (sr & (USART_SR_ORE | USART_SR_NE | USART_SR_FE | USART_SR_PE)) {
-		isr_read_error();
-	} else if (sr & USART_SR_RXNE) {
-		fail_event(&isr_usart_fails, 0);
-		isr_read_command(dr & 0xff);
+unsigned char *usart2_next_command() {
+	// 1. Free the last command if it was being read from.
+	if (is_reading) {
+		read_frame = (read_frame + 1) % CMD_FRAME_COUNT;
+		atomic_decrement(&frames_pending);
+
+		is_reading = 0;
+	}
+
+	// 2. Check if an overflow needs to be reported.
+	if (command_overflow) {
+		error(ER_CMDOVERFLOW, STR_WITH_LEN("CO"), EA_RESUME);
+		atomic_reset(&command_overflow);
+	}
+
+	// 3. Check if there is a new command.
+	// Note that this section need not be atomic, because even if
+	// the parser runs here, it can only append to the queue and
+	// never overwrite a queued command.
+	if (frames_pending > 0) {
+		is_reading = 1;
+		return cmd_ring + frames[read_frame].start;
 	} else {
-		error(ER_USART_RX, STR_WITH_LEN("Strange interrupt on USART."), EA_PANIC);
+		return (unsigned char*) 0;
 	}
 }
 
 /*
- * ISR for USART2.
+ * Returns the board time at which the command last returned by
+ * usart2_next_command was received completely.
  */
-void __attribute__ ((interrupt("IRQ"))) isr_usart2() {
-#ifdef COUNT_USART_ISR
-	cycle_start();
-#endif
+uint32_t usart2_received_at() {
+	uint32_t now = board_time;
+	uint16_t waited = (uint16_t) now - frames[read_frame].received_at;
 
-	unsigned short sr = USART2_SR;
-	unsigned short dr = USART2_DR;
+	return now - waited;
+}
 
-	isr_dispatch(sr, dr);
+/*
+ * Returns whether there are queued commands that have not been
+ * returned by usart2_next_command yet.
+ */
+bool usart2_data_available() {
+	return frames_pending > is_reading;
+}
 
-#ifdef COUNT_USART_ISR
-	int cycles = cycle_get();
-	debug_string("UC2");
-	debug_write((char*) &cycles, 4);
-#endif
+/*
+ * Sets a command filter function for USART reception.
+ * The filter gets passed a USART command and must return a nonzero value
+ * to indicate interest in the command.
+ */
+void usart2_set_address_filter(usart_address_filter_t filter) {
+	address_filter = filter;
+}
+
+/*
+ * Sets a length check function for USART reception.
+ */
+void usart2_set_length_check(usart_length_check_t check) {
+	length_check = check;
+}
+
+/*
+ * Copies the counters of the bus traffic since startup to out.
+ */
+void usart2_get_stats(usart_stats_t *out) {
+	*out = stats;
 
+	out->bytes = usart2_rx_produced();
+	out->framing_errors = usart2_rx_error_count(USART_FRAMING_ERROR);
+	out->noise_errors = usart2_rx_error_count(USART_NOISE_ERROR);
+	out->overrun_errors = usart2_rx_error_count(USART_OVERRUN_ERROR);
 }
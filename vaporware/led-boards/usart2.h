@@ -7,6 +7,7 @@
  * managed by the console module.
  */
 
+#include <limits.h>
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -20,7 +21,39 @@ typedef bool ((*usart_address_filter_t)(uint8_t));
 /*
  * The type of function that can be passed to usart2_set_length_check.
  */
-typedef int ((*usart_length_check_t)(uint8_t*, int));
+typedef int ((*usart_length_check_t)(uint8_t*, int, int*));
+
+/*
+ * Returned by a length check function to drop the command being
+ * received, see usart2_set_length_check.
+ */
+#define USART_DROP_COMMAND INT_MIN
+
+/*
+ * Counters of the bus traffic since startup, see usart2_get_stats.
+ */
+typedef struct {
+	// Bytes received.
+	uint32_t bytes;
+	// Frames (start marks followed by an address) received.
+	uint32_t frames;
+	// Frames accepted by the address filter.
+	uint32_t frames_accepted;
+	// Reception errors.
+	uint32_t framing_errors;
+	uint32_t noise_errors;
+	uint32_t overrun_errors;
+	// Times the parser fell behind by more than the receive ring,
+	// and the bytes dropped because of this.
+	uint32_t overflows;
+	uint32_t dropped_bytes;
+	// Most bytes that have been waiting to be parsed at once.
+	uint32_t max_backlog;
+	// Commands dropped because the command queue was full.
+	uint32_t dropped_commands;
+	// Most commands that have been queued at once.
+	uint32_t max_queued;
+} usart_stats_t;
 
 /*
  * Initializes the RS485 bus USART. This must be called before any other
@@ -29,12 +62,35 @@ typedef int ((*usart_length_check_t)(uint8_t*, int));
 void usart2_init();
 
 /*
- * Returns a pointer to a buffer containing the next available USART command that
- * the current filter is interested in.
+ * Parses the bytes the DMA has received since the last call and queues
+ * the commands the current filter is interested in. This is called
+ * from the USART2, DMA1 channel 6 and systick interrupts, which
+ * usart2_hal_init sets to the same priority so that they never
+ * preempt each other; the parser is not reentrant.
+ */
+void usart2_parse();
+
+/*
+ * Returns a pointer to the next queued USART command that the current
+ * filter is interested in. The command is not copied, it stays valid
+ * in the queue until the next call.
  * If no command is available, returns NULL.
  */
 unsigned char *usart2_next_command();
 
+/*
+ * Returns the board time at which the command last returned by
+ * usart2_next_command was received completely. It may have waited in
+ * the queue since then.
+ */
+uint32_t usart2_received_at();
+
+/*
+ * Returns whether there are queued commands that have not been
+ * returned by usart2_next_command yet.
+ */
+bool usart2_data_available();
+
 /*
  * Sets a command filter function for USART reception.
  * The filter gets passed a USART command and must return a nonzero value
@@ -46,22 +102,31 @@ void usart2_set_address_filter(usart_address_filter_t filter);
  * Sets a length check function for USART reception.
  *
  * After the first byte of a command (after the address byte) is
- * received by the ISR, the length check function is called to
+ * parsed, the length check function is called to
  * determine, if the command currently received is complete.
 
  * The length check function must return the minimum number of bytes
  * which need to be received to make a complete command. It will be
  * called again after this number of bytes has been received.
  *
- * Since timing is critical in the ISR, the length check function
- * should parse the command as little as possible, and only ascertain
- * its required length.
+ * Through its third argument, it can also make the parser drop a
+ * number of bytes before the next ones are stored. These bytes don't
+ * count towards the bytes returned.
+ *
+ * If the command turns out to be of no interest, the length check
+ * function can return USART_DROP_COMMAND. The command is then not
+ * queued, and the rest of the frame is ignored like a frame for
+ * another address.
+ *
+ * Since it is called for every byte of our commands, the length check
+ * function should parse the command as little as possible, and only
+ * ascertain its required length.
  */
 void usart2_set_length_check(usart_length_check_t length_check);
 
 /*
- * ISR for USART2.
+ * Copies the counters of the bus traffic since startup to stats.
  */
-void isr_usart2();
+void usart2_get_stats(usart_stats_t *stats);
 
 #endif
@@ -0,0 +1,196 @@
+#include "usart2_hal.h"
+
+#include "config.h"
+#include "error.h"
+#include "trace.h"
+#include "usart2.h"
+
+#include "stm_include/stm32/dma.h"
+#include "stm_include/stm32/nvic.h"
+#include "stm_include/stm32/scb.h"
+#include "stm_include/stm32/usart.h"
+
+/*
+ * Reception works without the CPU: DMA1 channel 6 copies every byte
+ * received by USART2 into usart2_rx_ring, wrapping around at its end.
+ * The interrupts (half and full transfer of the DMA, idle line and
+ * errors of the USART) do the bookkeeping and run the parser
+ * (usart2_parse) on what has arrived.
+ */
+
+_Static_assert(USART_RX_RING_LEN % 2 == 0, "The receive ring must consist of two halves");
+#define RX_HALF (USART_RX_RING_LEN / 2)
+
+/*
+ * The priority of all interrupts that run the parser. The parser is
+ * not reentrant: it relies on them not preempting each other, so they
+ * must share one priority level. This is the reset value, which the
+ * other interrupts have as well.
+ */
+#define PARSER_IRQ_PRIORITY 0
+
+// The receive ring written by the DMA.
+unsigned char usart2_rx_ring[USART_RX_RING_LEN];
+
+/*
+ * rx_halves counts the halves of the ring the DMA has filled, so together
+ * with the DMA's transfer counter, it gives the total number of bytes
+ * received. rx_errors counts the reception errors, and rx_error_at is the
+ * number of bytes that had been received at the last one. All of them
+ * are only written by the ISRs.
+ */
+static volatile uint32_t rx_halves = 0;
+static volatile uint32_t rx_errors = 0;
+static volatile uint32_t rx_error_at = 0;
+
+// The reception errors by kind, for the statistics.
+static volatile uint32_t rx_error_kinds[USART_ERROR_KINDS];
+
+/*
+ * Sets up the USART and the DMA and starts reception.
+ */
+void usart2_hal_init() {
+	// Set up DMA (channel 6 of DMA 1 is wired to USART2_RX)
+	DMA1_CPAR6 = (uint32_t) &USART2_DR;
+	DMA1_CMAR6 = (uint32_t) &usart2_rx_ring;
+	DMA1_CNDTR6 = USART_RX_RING_LEN;
+	DMA1_CCR6 = (DMA_CCR6_PL_VERY_HIGH << DMA_CCR6_PL_LSB) | // Highest priority, we can't lose bytes
+		(DMA_CCR6_MSIZE_8BIT << DMA_CCR6_MSIZE_LSB) |    // 8 bit memory size
+		(DMA_CCR6_PSIZE_8BIT << DMA_CCR6_PSIZE_LSB) |    // 8 bit peripheral size
+		DMA_CCR6_MINC |                                  // Memory auto-increment
+		DMA_CCR6_CIRC |                                  // Circular mode
+		DMA_CCR6_TEIE |                                  // Transfer error interrupt
+		DMA_CCR6_HTIE |                                  // Half transfer interrupt
+		DMA_CCR6_TCIE |                                  // Transfer complete interrupt
+		DMA_CCR6_EN;                                     // enable
+
+	USART2_BRR = USART_BAUD_VALUE;
+
+	USART2_CR3 = USART_CR3_DMAR | // Received bytes go to the DMA
+		USART_CR3_EIE;        // Interrupt on reception errors
+
+	USART2_CR1 = USART_CR1_UE |
+		USART_CR1_IDLEIE |
+		USART_CR1_RE;
+
+	// The systick runs the parser as well. Its priority is in the
+	// byte for exception 15; SCB_SHPR counts from exception 4.
+	NVIC_IPR(NVIC_DMA1_CHANNEL6_IRQ) = PARSER_IRQ_PRIORITY;
+	NVIC_IPR(NVIC_USART2_IRQ) = PARSER_IRQ_PRIORITY;
+	SCB_SHPR(15 - 4) = PARSER_IRQ_PRIORITY;
+
+	NVIC_ISER(0) |= (1 << NVIC_DMA1_CHANNEL6_IRQ);
+	NVIC_ISER(1) |= (1 << (NVIC_USART2_IRQ - 32));
+}
+
+/*
+ * Returns the total number of bytes the DMA has written to usart2_rx_ring
+ * (modulo 2^32).
+ */
+uint32_t usart2_rx_produced() {
+	uint32_t halves;
+	uint32_t pos;
+
+	// Make sure the counter and the position belong together.
+	do {
+		halves = rx_halves;
+		pos = USART_RX_RING_LEN - DMA1_CNDTR6;
+	} while (halves != rx_halves);
+
+	// The DMA may have entered the next half, but its interrupt
+	// has not been handled yet.
+	if ((pos / RX_HALF) != (halves & 1)) {
+		halves++;
+	}
+
+	return halves * RX_HALF + pos % RX_HALF;
+}
+
+/*
+ * The RAM between the static variables and the stack, set up by the
+ * linker script.
+ */
+extern unsigned char _cmd_ring_start;
+extern unsigned char _cmd_ring_end;
+
+/*
+ * Returns the memory for the command queue and stores its length in
+ * length.
+ */
+unsigned char *usart2_cmd_memory(uint32_t *length) {
+	*length = &_cmd_ring_end - &_cmd_ring_start;
+	return &_cmd_ring_start;
+}
+
+/*
+ * Returns the number of reception errors so far. The number of bytes
+ * that had been received at the last one is stored in at.
+ */
+uint32_t usart2_rx_errors(uint32_t *at) {
+	*at = rx_error_at;
+	return rx_errors;
+}
+
+/*
+ * Returns the number of reception errors of the given kind so far.
+ */
+uint32_t usart2_rx_error_count(usart_error_kind_t kind) {
+	return rx_error_kinds[kind];
+}
+
+/*
+ * ISR for USART2. This is only called on reception errors and when
+ * the line goes idle.
+ */
+void __attribute__ ((interrupt("IRQ"))) isr_usart2() {
+	trace_begin(TRACE_USART_ISR);
+
+	unsigned short sr = USART2_SR;
+
+	if (sr & (USART_SR_ORE | USART_SR_NE | USART_SR_FE | USART_SR_PE)) {
+		rx_error_at = usart2_rx_produced();
+		rx_errors++;
+
+		if (sr & USART_SR_FE) rx_error_kinds[USART_FRAMING_ERROR]++;
+		if (sr & USART_SR_NE) rx_error_kinds[USART_NOISE_ERROR]++;
+		if (sr & USART_SR_ORE) rx_error_kinds[USART_OVERRUN_ERROR]++;
+		if (sr & USART_SR_PE) rx_error_kinds[USART_PARITY_ERROR]++;
+	}
+
+	// The flags are cleared by reading DR after SR. Unless a byte
+	// is waiting, the DMA has already taken it and we don't lose anything.
+	if (!(sr & USART_SR_RXNE)) {
+		(void) USART2_DR;
+	}
+
+	// Parse whatever has arrived, so a command at the end of a burst
+	// is not delayed.
+	usart2_parse();
+
+	trace_end(TRACE_USART_ISR);
+}
+
+/*
+ * ISR for DMA1 channel 6 (USART2 reception). Counts the halves of the
+ * receive ring that have been filled and parses them.
+ */
+void __attribute__ ((interrupt("IRQ"))) isr_dma1_channel6() {
+	trace_begin(TRACE_USART_ISR);
+
+	uint32_t flags = DMA1_ISR;
+	DMA1_IFCR = DMA_IFCR_CGIF6;
+
+	if (flags & DMA_ISR_TEIF6) {
+		error(ER_USART_RX, STR_WITH_LEN("DMA error on USART."), EA_PANIC);
+	}
+	if (flags & DMA_ISR_HTIF6) {
+		rx_halves++;
+	}
+	if (flags & DMA_ISR_TCIF6) {
+		rx_halves++;
+	}
+
+	usart2_parse();
+
+	trace_end(TRACE_USART_ISR);
+}
@@ -0,0 +1,73 @@
+#ifndef USART2_HAL_H
+#define USART2_HAL_H
+
+/*
+ * The hardware side of the RS485 bus USART (USART2): it receives the
+ * bus traffic into a ring buffer, which the parser in usart2.c reads.
+ * A host build provides its own version of these functions (see
+ * host/).
+ */
+
+#include <stdint.h>
+
+#include "config.h"
+
+/*
+ * The ring buffer the received bytes are written to, wrapping around
+ * at its end.
+ */
+extern unsigned char usart2_rx_ring[USART_RX_RING_LEN];
+
+/*
+ * Sets up the USART and starts reception.
+ */
+void usart2_hal_init();
+
+/*
+ * Returns the total number of bytes written to usart2_rx_ring (modulo
+ * 2^32).
+ */
+uint32_t usart2_rx_produced();
+
+/*
+ * Returns the memory for the command queue and stores its length in
+ * length. On the board, this is the RAM left over by everything else
+ * (see linker.ld).
+ */
+unsigned char *usart2_cmd_memory(uint32_t *length);
+
+/*
+ * Returns the number of reception errors so far. The number of bytes
+ * that had been received at the last one is stored in at.
+ */
+uint32_t usart2_rx_errors(uint32_t *at);
+
+/*
+ * The kinds of reception errors.
+ */
+typedef enum {
+	USART_FRAMING_ERROR,
+	USART_NOISE_ERROR,
+	USART_OVERRUN_ERROR,
+	USART_PARITY_ERROR,
+
+	USART_ERROR_KINDS
+} usart_error_kind_t;
+
+/*
+ * Returns the number of reception errors of the given kind so far.
+ * One broken byte may count as more than one kind.
+ */
+uint32_t usart2_rx_error_count(usart_error_kind_t kind);
+
+/*
+ * ISR for USART2.
+ */
+void isr_usart2();
+
+/*
+ * ISR for DMA1 channel 6, which receives from USART2.
+ */
+void isr_dma1_channel6();
+
+#endif